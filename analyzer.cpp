@@ -2,166 +2,2444 @@
 
 #include <algorithm>
 #include <unordered_map>
+#include <map>
+#include <set>
 #include <array>
 #include <cstring>
+#include <cstdint>
+#include <charconv>
+#include <cmath>
 #include <cstdio>
-#include <fstream>
+#include <thread>
+#include <type_traits>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 
-// ---------------- storage ----------------
-static unordered_map<string, long long> zoneCounts;
-static unordered_map<string, array<long long, 24>> slotCounts;
+// ---------------- memory ----------------
+// Allocation for the big tables and the read buffer. Blocks of at least
+// HUGE_PAGE bytes are mapped directly on 2 MiB boundaries; with huge pages
+// selected (IngestOptions::hugePages) they come from reserved hugetlb pages
+// when the system has any, else are marked MADV_HUGEPAGE so transparent huge
+// pages can back them. Smaller blocks are just cache-line aligned. The path
+// depends on the size alone, so a block is freed correctly even if the
+// switch changed since it was allocated.
+static const size_t HUGE_PAGE = size_t(2) << 20;
+static const size_t CACHE_LINE = 64;
+static bool hugePages = false;
+
+static inline size_t hugeRound(size_t bytes) {
+    return (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+}
+
+static void* allocBlock(size_t bytes) {
+#if defined(__linux__)
+    if (bytes >= HUGE_PAGE) {
+        const size_t len = hugeRound(bytes);
+#ifdef MAP_HUGETLB
+        if (hugePages) {
+            void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) return p;
+        }
+#endif
+        // over-map by one huge page and trim to a 2 MiB aligned range
+        char* raw = (char*)mmap(nullptr, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == (char*)MAP_FAILED) throw bad_alloc();
+        char* p = (char*)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+        if (p > raw) munmap(raw, (size_t)(p - raw));
+        munmap(p + len, (size_t)(raw + HUGE_PAGE - p));
+#ifdef MADV_HUGEPAGE
+        if (hugePages) madvise(p, len, MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+#endif
+    return ::operator new(bytes, align_val_t(CACHE_LINE));
+}
+
+static void freeBlock(void* p, size_t bytes) {
+#if defined(__linux__)
+    if (bytes >= HUGE_PAGE) {
+        munmap(p, hugeRound(bytes));
+        return;
+    }
+#endif
+    ::operator delete(p, align_val_t(CACHE_LINE));
+}
+
+template <class T>
+struct PageAllocator {
+    using value_type = T;
+
+    PageAllocator() = default;
+    template <class U>
+    PageAllocator(const PageAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)allocBlock(n * sizeof(T)); }
+    void deallocate(T* p, size_t n) { freeBlock(p, n * sizeof(T)); }
+
+    template <class U>
+    bool operator==(const PageAllocator<U>&) const { return true; }
+    template <class U>
+    bool operator!=(const PageAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using BigVector = vector<T, PageAllocator<T>>;
+
+// ---------------- storage ----------------
+// Open-addressing counter table for packed 64-bit keys (zone-id pairs,
+// zone/hour slots). Linear probing over flat arrays keeps ~23 bytes per
+// entry at the 0.7 load cap, versus a heap node per entry in unordered_map.
+struct CountTable {
+    static constexpr uint64_t EMPTY = ~0ULL;
+
+    BigVector<uint64_t> keys;
+    BigVector<long long> counts;
+    size_t used = 0;
+
+    static uint64_t pack(int a, int b) {
+        return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+    }
+
+    static size_t hash(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        return (size_t)k;
+    }
+
+    void clear() {
+        keys.clear();
+        counts.clear();
+        used = 0;
+    }
+
+    void add(uint64_t key) {
+        if ((used + 1) * 10 > keys.size() * 7) grow();
+
+        size_t mask = keys.size() - 1;
+        size_t i = hash(key) & mask;
+        while (keys[i] != key) {
+            if (keys[i] == EMPTY) {
+                keys[i] = key;
+                used++;
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        counts[i]++;
+    }
+
+    long long get(uint64_t key) const {
+        if (keys.empty()) return 0;
+        size_t mask = keys.size() - 1;
+        for (size_t i = hash(key) & mask; keys[i] != EMPTY; i = (i + 1) & mask)
+            if (keys[i] == key) return counts[i];
+        return 0;
+    }
+
+    template <class F>
+    void forEach(F&& f) const {
+        for (size_t i = 0; i < keys.size(); ++i)
+            if (keys[i] != EMPTY) f(keys[i], counts[i]);
+    }
+
+    void grow() {
+        size_t cap = keys.empty() ? 1024 : keys.size() * 2;
+        BigVector<uint64_t> oldKeys(cap, EMPTY);
+        BigVector<long long> oldCounts(cap, 0);
+        oldKeys.swap(keys);
+        oldCounts.swap(counts);
+
+        size_t mask = cap - 1;
+        for (size_t j = 0; j < oldKeys.size(); ++j) {
+            if (oldKeys[j] == EMPTY) continue;
+            size_t i = hash(oldKeys[j]) & mask;
+            while (keys[i] != EMPTY) i = (i + 1) & mask;
+            keys[i] = oldKeys[j];
+            counts[i] = oldCounts[j];
+        }
+    }
+};
+
+// Fare/distance sums, only grown while metrics are enabled.
+struct Metrics {
+    vector<double> revenue;                 // zone id -> fare total
+    vector<double> distance;                // zone id -> km total
+    vector<array<double, 24>> fareSum;      // zone id -> fare total per hour
+    vector<array<long long, 24>> fareTrips; // zone id -> trips with a valid fare per hour
+    long long badDistance = 0;
+    long long badFare = 0;
+
+    void clear() {
+        revenue.clear();
+        distance.clear();
+        fareSum.clear();
+        fareTrips.clear();
+        badDistance = badFare = 0;
+    }
+
+    void fit(size_t zones) {
+        if (revenue.size() >= zones) return;
+        revenue.resize(zones, 0.0);
+        distance.resize(zones, 0.0);
+        fareSum.resize(zones, array<double, 24>{});
+        fareTrips.resize(zones, array<long long, 24>{});
+    }
+};
+
+// DDSketch: log-spaced buckets with 1% relative error. Bucket counts are
+// capped at MAX_BINS by folding the lowest buckets together, so upper
+// quantiles stay accurate and memory per sketch is bounded. Sketches with
+// the same gamma merge exactly by adding bucket counts.
+class QuantileSketch {
+public:
+    static constexpr double ALPHA = 0.01;
+    static constexpr int MAX_BINS = 2048;   // about 10^17 between lowest and highest bucket
+    static constexpr double MIN_VALUE = 1e-9;   // smaller values land in the zero bucket
+
+    void add(double v) {
+        total++;
+        if (v < MIN_VALUE) { zeros++; return; }
+        addKey((int)ceil(log(v) * invLogGamma()), 1);
+    }
+
+    void merge(const QuantileSketch& o) {
+        total += o.total;
+        zeros += o.zeros;
+        for (size_t i = 0; i < o.bins.size(); ++i)
+            if (o.bins[i]) addKey(o.offset + (int)i, o.bins[i]);
+    }
+
+    long long count() const { return total; }
+
+    double quantile(double q) const {
+        if (total == 0) return 0.0;
+        q = min(max(q, 0.0), 1.0);
+        const double rank = q * (double)(total - 1);
+
+        double seen = (double)zeros;
+        if (rank < seen) return 0.0;
+        for (size_t i = 0; i < bins.size(); ++i) {
+            seen += bins[i];
+            if (rank < seen) return valueOf(offset + (int)i);
+        }
+        return valueOf(offset + (int)bins.size() - 1);
+    }
+
+private:
+    static double gamma() { return (1 + ALPHA) / (1 - ALPHA); }
+    static double invLogGamma() {
+        static const double v = 1.0 / log(gamma());
+        return v;
+    }
+    static double valueOf(int key) {
+        return 2.0 * pow(gamma(), key) / (gamma() + 1.0);
+    }
+
+    void addKey(int key, uint64_t n) {
+        if (bins.empty()) {
+            offset = key;
+            bins.assign(1, 0);
+        } else if (key < offset) {
+            const int top = offset + (int)bins.size() - 1;
+            key = max(key, top - MAX_BINS + 1);
+            bins.insert(bins.begin(), (size_t)(offset - key), 0);
+            offset = key;
+        } else if (key >= offset + (int)bins.size()) {
+            bins.resize((size_t)(key - offset + 1), 0);
+            if ((int)bins.size() > MAX_BINS) {
+                const size_t drop = bins.size() - MAX_BINS;
+                uint64_t folded = 0;
+                for (size_t i = 0; i < drop; ++i) folded += bins[i];
+                bins.erase(bins.begin(), bins.begin() + drop);
+                bins[0] += folded;
+                offset += (int)drop;
+            }
+        }
+        bins[(size_t)(key - offset)] += n;
+    }
+
+    int offset = 0;              // key of bins[0]
+    vector<uint64_t> bins;
+    long long zeros = 0;
+    long long total = 0;
+};
+
+struct TripSketches {
+    QuantileSketch fare;
+    QuantileSketch distance;
+};
+
+struct Sketches {
+    vector<TripSketches> zones;          // zone id -> sketches
+    array<TripSketches, 24> hours;       // all zones, per pickup hour
+
+    void clear() {
+        zones.clear();
+        hours = {};
+    }
+};
+
+// Zones ordered by (count desc, zone asc), kept current row by row.
+// Zones sharing a count live in one name-ordered bucket; an increment moves a
+// zone to the adjacent bucket, so the order never needs a full re-sort.
+class LiveRanking {
+public:
+    explicit LiveRanking(const vector<string>& names)
+        : names(names) {}
+
+    bool active = false;
+
+    void clear() {
+        buckets.clear();
+        where.clear();
+        active = false;
+    }
+
+    // Adopts the counts accumulated so far (live ranking turned on mid-stream).
+    void seed(const BigVector<long long>& counts) {
+        clear();
+        active = true;
+        where.resize(counts.size(), buckets.end());
+        for (size_t id = 0; id < counts.size(); ++id)
+            if (counts[id] > 0) {
+                auto b = buckets.try_emplace(counts[id], Bucket(NameLess{&names})).first;
+                b->second.insert((int)id);
+                where[id] = b;
+            }
+    }
+
+    // Zone `id` just went from count - 1 to count.
+    void bump(int id, long long count) {
+        if ((size_t)id >= where.size()) where.resize(names.size(), buckets.end());
+
+        auto from = where[id];
+        auto to = from == buckets.end() ? buckets.begin() : next(from);
+        if (to == buckets.end() || to->first != count)
+            to = buckets.emplace_hint(to, count, Bucket(NameLess{&names}));
+
+        to->second.insert(id);
+        if (from != buckets.end()) {
+            from->second.erase(id);
+            if (from->second.empty()) buckets.erase(from);
+        }
+        where[id] = to;
+    }
+
+    template <class F>
+    void forTop(size_t k, F&& emit) const {
+        for (auto b = buckets.rbegin(); b != buckets.rend(); ++b)
+            for (int id : b->second) {
+                if (k-- == 0) return;
+                emit(id, b->first);
+            }
+    }
+
+private:
+    struct NameLess {
+        const vector<string>* names;
+        bool operator()(int a, int b) const { return (*names)[a] < (*names)[b]; }
+    };
+    using Bucket = set<int, NameLess>;
+
+    const vector<string>& names;
+    map<long long, Bucket> buckets;                     // count -> zones
+    vector<map<long long, Bucket>::iterator> where;     // zone id -> its bucket
+};
+
+// Trips of one pickup day, keyed by (zone id, hour). Only slots that saw a
+// trip that day take space, so long date ranges over many zones stay sparse.
+struct DayPartition {
+    int weekday = 0;                                   // 0 = Sunday
+    CountTable slots;
+
+    static uint64_t key(int id, int hour) {
+        return (uint64_t)(uint32_t)id << 5 | (unsigned)hour;
+    }
+    static int zoneOf(uint64_t key) { return (int)(key >> 5); }
+    static int hourOf(uint64_t key) { return (int)(key & 31); }
+};
+
+// 64-bit hash of a zone name, 8 bytes per multiply.
+static inline uint64_t hashKey(const char* s, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    for (; n >= 8; s += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    if (n) {
+        uint64_t w = 0;
+        memcpy(&w, s, n);
+        h = (h ^ w) * 0x94D049BB133111EBULL;
+    }
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+// Zone name -> id, open addressing. A slot is the upper half of the name's
+// hash plus the id (8 bytes, 8 slots per cache line), so a probe touches the
+// name itself only on a tag match; the names live in Tables::zoneNames.
+// Callers hash once and can prefetch() the home slot ahead of the lookup.
+struct ZoneDict {
+    struct Slot {
+        uint32_t tag;
+        int32_t id;             // -1 = empty
+    };
+
+    BigVector<Slot> slots;
+    size_t used = 0;
+
+    void clear() {
+        slots.clear();
+        used = 0;
+    }
+
+    void prefetch(uint64_t h) const {
+        if (!slots.empty()) __builtin_prefetch(&slots[h & (slots.size() - 1)]);
+    }
+
+    int find(const char* s, size_t n, uint64_t h, const vector<string>& names) const {
+        if (slots.empty()) return -1;
+        const size_t mask = slots.size() - 1;
+        const uint32_t tag = (uint32_t)(h >> 32);
+        for (size_t i = h & mask; slots[i].id >= 0; i = (i + 1) & mask) {
+            const Slot& e = slots[i];
+            if (e.tag == tag && names[e.id].size() == n && memcmp(names[e.id].data(), s, n) == 0)
+                return e.id;
+        }
+        return -1;
+    }
+
+    // id must not be present yet
+    void insert(uint64_t h, int id, const vector<string>& names) {
+        if ((used + 1) * 2 > slots.size()) grow(names);
+        place(h, id);
+        used++;
+    }
+
+private:
+    void place(uint64_t h, int id) {
+        const size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        while (slots[i].id >= 0) i = (i + 1) & mask;
+        slots[i] = {(uint32_t)(h >> 32), id};
+    }
+
+    void grow(const vector<string>& names) {
+        size_t cap = slots.empty() ? 1024 : slots.size() * 2;
+        BigVector<Slot> old(cap, Slot{0, -1});
+        old.swap(slots);
+        for (const Slot& e : old)
+            if (e.id >= 0) place(hashKey(names[e.id].data(), names[e.id].size()), e.id);
+    }
+};
+
+// Direct-indexed ids for zone names of the form <prefix><digits> ("ZONE254",
+// "ZONE042"). The first LEARN new zones must all share one prefix; after that
+// a matching name is looked up by its digits in a dense array instead of the
+// hash table. The first name that doesn't fit switches it off until clear().
+struct NumericZones {
+    enum State { Learning, Active, Off };
+
+    static const size_t LEARN = 32;
+    static const size_t MAX_DIGITS = 6;
+
+    State state = Learning;
+    string prefix;
+    vector<int> ids;            // suffixKey -> zone id, -1 = not interned yet
+    size_t learned = 0;
+
+    // Digit strings of each length get their own key range (1 digit: 1-10,
+    // 2 digits: 11-110, ...), so "ZONE7" and "ZONE07" stay distinct.
+    // -1 if the name isn't <prefix> followed by 1..MAX_DIGITS digits.
+    long suffixKey(const char* s, size_t n) const {
+        const size_t p = prefix.size();
+        if (n <= p || n - p > MAX_DIGITS || memcmp(s, prefix.data(), p) != 0) return -1;
+        long v = 0;
+        long base = 0;
+        for (size_t i = p; i < n; ++i) {
+            unsigned d = (unsigned)(s[i] - '0');
+            if (d > 9) return -1;
+            v = v * 10 + d;
+            base = base * 10 + 1;
+        }
+        return v + base;
+    }
+
+    // id of a known zone, or -1 when the caller has to go through the hash table
+    int find(const char* s, size_t n) {
+        long key = suffixKey(s, n);
+        if (key < 0) {
+            stop();
+            return -1;
+        }
+        return (size_t)key < ids.size() ? ids[key] : -1;
+    }
+
+    // Records a newly interned zone.
+    void add(const string& name, int id) {
+        if (state == Off) return;
+        if (state == Learning && learned == 0) {
+            size_t p = name.size();
+            while (p > 0 && (unsigned)(name[p - 1] - '0') <= 9) --p;
+            prefix.assign(name, 0, p);
+        }
+        long key = suffixKey(name.data(), name.size());
+        if (key < 0) {
+            stop();
+            return;
+        }
+        if ((size_t)key >= ids.size()) ids.resize((size_t)key + 1, -1);
+        ids[key] = id;
+        if (state == Learning && ++learned == LEARN) state = Active;
+    }
+
+    void stop() {
+        state = Off;
+        vector<int>().swap(ids);
+    }
+
+    void clear() {
+        state = Learning;
+        prefix.clear();
+        ids.clear();
+        learned = 0;
+    }
+};
+
+// Zones are interned once per row; the per-zone tables are indexed by zone id.
+struct Tables {
+    ZoneDict zoneIds;
+    vector<string> zoneNames;
+    BigVector<long long> zoneCounts;
+    BigVector<array<long long, 24>> slotCounts;
+    map<int, DayPartition> days;                       // day index -> partition
+    CountTable routes;                                  // pickup -> dropoff trips
+    Metrics metrics;
+    Sketches sketches;
+    LiveRanking live{zoneNames};
+    NumericZones numeric;
+
+    // last partition touched; rows are usually clustered by date
+    int lastDay = INT32_MIN;
+    DayPartition* lastPart = nullptr;
+
+    // last pickup zone; sorted or clustered exports repeat it row after row
+    string lastZone;
+    int lastZoneId = -1;
+
+    // bumped whenever the tables change; cached rankings compare against it
+    unsigned long long generation = 1;
+    // bumped when the zone dictionary is dropped
+    unsigned long long epoch = 1;
+
+    void clear() {
+        generation++;
+        epoch++;
+        zoneIds.clear();
+        zoneNames.clear();
+        zoneCounts.clear();
+        slotCounts.clear();
+        days.clear();
+        routes.clear();
+        metrics.clear();
+        sketches.clear();
+        live.clear();
+        lastDay = INT32_MIN;
+        lastPart = nullptr;
+        lastZone.clear();
+        lastZoneId = -1;
+        numeric.clear();
+    }
+
+    int find(const char* s, size_t n) const {
+        return zoneIds.find(s, n, hashKey(s, n), zoneNames);
+    }
+
+    // h is hashKey(s, n)
+    int intern(const char* s, size_t n, uint64_t h) {
+        if (numeric.state == NumericZones::Active) {
+            int id = numeric.find(s, n);
+            if (id >= 0) return id;
+        }
+        int id = zoneIds.find(s, n, h, zoneNames);
+        if (id >= 0) return id;
+
+        id = (int)zoneNames.size();
+        zoneNames.emplace_back(s, n);
+        zoneCounts.push_back(0);
+        slotCounts.push_back({});
+        zoneIds.insert(h, id, zoneNames);
+        numeric.add(zoneNames.back(), id);
+        return id;
+    }
+
+    // intern() for pickup zones, skipping the lookup when the zone repeats.
+    // The id (not a counter pointer) is cached: interning a new dropoff zone
+    // can reallocate the counter vectors.
+    int internPickup(const char* s, size_t n, uint64_t h) {
+        if (lastZoneId >= 0 && n == lastZone.size() && memcmp(s, lastZone.data(), n) == 0)
+            return lastZoneId;
+        lastZoneId = intern(s, n, h);
+        lastZone.assign(s, n);
+        return lastZoneId;
+    }
+
+    DayPartition& partition(int day);
+};
+
+static Tables tables;
+
+// ---------------- helpers ----------------
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline uint64_t load64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's days_from_civil).
+static inline int daysFromCivil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int)doe - 719468;
+}
+
+// SWAR digit checks: every lane selected by `lanes` holds '0'-'9'. Non-digit
+// lanes are masked out before the +6 so nothing carries between lanes.
+static inline bool digitLanes(uint64_t w, uint64_t lanes) {
+    const uint64_t ZEROS = 0x3030303030303030ULL & lanes;
+    const uint64_t x = w & lanes;
+    return ((x & 0xF0F0F0F0F0F0F0F0ULL) == ZEROS) &&
+           (((x + (0x0606060606060606ULL & lanes)) & 0xF0F0F0F0F0F0F0F0ULL) == ZEROS);
+}
+
+// Pairs adjacent digit lanes: lane i of the result is 10 * lane i + lane i+1.
+static inline uint64_t digitPairs(uint64_t w, uint64_t lanes) {
+    const uint64_t x = (w & lanes) - (0x3030303030303030ULL & lanes);
+    return x * 10 + (x >> 8);
+}
+
+static inline bool isLeap(unsigned y) {
+    return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+// Day d exists in month m (1-12) of year y; the leap rule only runs for Feb 29.
+static inline bool validDay(unsigned y, unsigned m, unsigned d) {
+    static const unsigned char DAYS[13] = {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return d >= 1 && d <= DAYS[m] && (m != 2 || d < 29 || isLeap(y));
+}
+
+// "YYYY-MM-" as one word: lanes 0-3, 5-6 are digits, lanes 4 and 7 are '-'.
+static const uint64_t DATE_DIGITS = 0x00FFFF00FFFFFFFFULL;
+static const uint64_t DATE_DASHES = 0xFF0000FF00000000ULL;
+
+// Year and month from the first word of a date; false unless the word is
+// exactly "YYYY-MM-" with a real month.
+static inline bool parseYearMonth(uint64_t w, unsigned& y, unsigned& m) {
+    if ((w & DATE_DASHES) != 0x2D00002D00000000ULL || !digitLanes(w, DATE_DIGITS)) return false;
+
+    uint64_t x = (w & DATE_DIGITS) - (0x3030303030303030ULL & DATE_DIGITS);
+    uint32_t yy = (uint32_t)x;                             // 4 year digits
+    yy = (yy * 10 + (yy >> 8)) & 0x00FF00FF;
+    yy = (yy * 100 + (yy >> 16)) & 0x0000FFFF;
+
+    y = yy;
+    m = (unsigned)((x * 10 + (x >> 8)) >> 40) & 0xFF;
+    return m >= 1 && m <= 12;
+}
+
+// Parses "YYYY-MM-DD" (the date range bounds) into a day index; false on bad
+// input, including days past the end of the month.
+static bool parseDay(const char* ts, const char* te, int& day) {
+    if (te - ts < 10) return false;
+
+    unsigned y, m;
+    if (!parseYearMonth(load64(ts), y, m)) return false;
+    if (!is_digit(ts[8]) || !is_digit(ts[9])) return false;
+
+    unsigned d = (unsigned)(ts[8] - '0') * 10 + (unsigned)(ts[9] - '0');
+    if (!validDay(y, m, d)) return false;
+
+    day = daysFromCivil((int)y, m, d);
+    return true;
+}
+
+// A pickup time, all fields decoded at once.
+struct Stamp {
+    int day;        // days since 1970-01-01
+    int hour;
+    int minute;
+};
+
+// "YYYY-MM-DD HH:MM" or "YYYY-MM-DDTHH:MM", optionally followed by ":SS" and
+// nothing else. Both 8-byte halves are validated and converted as words:
+// the second is "DD?HH:MM" with digit lanes 0-1, 3-4, 6-7.
+static bool parseStamp(const char* ts, const char* te, Stamp& out) {
+    const ptrdiff_t n = te - ts;
+    if (n != 16 && n != 19) return false;
+
+    unsigned y, m;
+    if (!parseYearMonth(load64(ts), y, m)) return false;
+
+    const uint64_t TIME_DIGITS = 0xFFFF00FFFF00FFFFULL;
+    const uint64_t w = load64(ts + 8);
+    const unsigned sep = (unsigned)(w >> 16) & 0xFF;
+    if ((sep != ' ' && sep != 'T') || (w & 0x0000FF0000000000ULL) != 0x00003A0000000000ULL) return false;
+    if (!digitLanes(w, TIME_DIGITS)) return false;
+
+    const uint64_t pairs = digitPairs(w, TIME_DIGITS);
+    const unsigned d = (unsigned)pairs & 0xFF;
+    const unsigned hour = (unsigned)(pairs >> 24) & 0xFF;
+    const unsigned minute = (unsigned)(pairs >> 48) & 0xFF;
+    if (!validDay(y, m, d) || hour > 23 || minute > 59) return false;
+
+    if (n == 19 && (ts[16] != ':' || !is_digit(ts[17]) || ts[17] > '5' || !is_digit(ts[18])))
+        return false;
+
+    out.day = daysFromCivil((int)y, m, d);
+    out.hour = (int)hour;
+    out.minute = (int)minute;
+    return true;
+}
+
+// Wall-clock stamp of a minute count since 1970-01-01 00:00 (floored, so
+// pre-epoch minutes land on the previous day).
+static inline void stampFromMinutes(long long mins, Stamp& out) {
+    long long day = mins / 1440;
+    long long rem = mins % 1440;
+    if (rem < 0) {
+        rem += 1440;
+        day--;
+    }
+    out.day = (int)day;
+    out.hour = (int)(rem / 60);
+    out.minute = (int)(rem % 60);
+}
+
+// ISO-8601 extended: a parseStamp body with optional ".fraction" after the
+// seconds, then an optional "Z", "+HH:MM", "+HHMM" or "+HH" (or '-').
+// Without a designator the time is already wall-clock; with one it is moved
+// to UTC and then by offsetMinutes.
+static bool parseIso(const char* ts, const char* te, int offsetMinutes, Stamp& out) {
+    const char* p = ts + 16;
+    if (te < p) return false;
+    if (p < te && *p == ':') {
+        p += 3;
+        if (te < p) return false;
+        if (p < te && *p == '.') {
+            const char* f = ++p;
+            while (p < te && is_digit(*p)) ++p;
+            if (p == f) return false;
+        }
+    }
+    if (!parseStamp(ts, ts + (p - ts > 16 ? 19 : 16), out)) return false;
+    if (p == te) return true;
+
+    int zone = 0;   // designator minutes east of UTC
+    if (*p == 'Z') {
+        if (p + 1 != te) return false;
+    } else if (*p == '+' || *p == '-') {
+        const ptrdiff_t n = te - p;
+        if (n != 3 && n != 5 && n != 6) return false;
+        const char* mm = n == 6 ? p + 4 : p + 3;
+        if (n == 6 && p[3] != ':') return false;
+        if (!is_digit(p[1]) || !is_digit(p[2])) return false;
+        int hh = (p[1] - '0') * 10 + (p[2] - '0');
+        int mi = 0;
+        if (n > 3) {
+            if (!is_digit(mm[0]) || !is_digit(mm[1])) return false;
+            mi = (mm[0] - '0') * 10 + (mm[1] - '0');
+        }
+        if (hh > 23 || mi > 59) return false;
+        zone = (hh * 60 + mi) * (*p == '-' ? -1 : 1);
+    } else {
+        return false;
+    }
+
+    stampFromMinutes((long long)out.day * 1440 + out.hour * 60 + out.minute - zone + offsetMinutes, out);
+    return true;
+}
+
+// Unix epoch seconds: 1-12 digits, optionally ".fraction" (ignored), shifted
+// by offsetMinutes. Integer arithmetic only.
+static bool parseEpoch(const char* ts, const char* te, int offsetMinutes, Stamp& out) {
+    const char* p = ts;
+    long long secs = 0;
+    while (p < te && is_digit(*p) && p - ts < 12) secs = secs * 10 + (*p++ - '0');
+    if (p == ts) return false;
+    if (p < te && *p == '.') {
+        const char* f = ++p;
+        while (p < te && is_digit(*p)) ++p;
+        if (p == f) return false;
+    }
+    if (p != te) return false;
+
+    stampFromMinutes(secs / 60 + offsetMinutes, out);
+    return true;
+}
+
+// 1970-01-01 was a Thursday (4); adding 7 + 4 keeps pre-epoch days non-negative
+// so no branch is needed.
+static inline int weekdayFromDays(int day) {
+    return (day % 7 + 11) % 7;
+}
+
+DayPartition& Tables::partition(int day) {
+    if (day != lastDay) {
+        lastPart = &days[day];
+        lastPart->weekday = weekdayFromDays(day);
+        lastDay = day;
+    }
+    return *lastPart;
+}
+
+// Non-negative finite decimal spanning the whole field; from_chars never touches the locale.
+static bool parseAmount(const char* s, const char* e, double& v) {
+    if (s >= e) return false;
+    auto r = from_chars(s, e, v);
+    return r.ec == errc() && r.ptr == e && v >= 0.0 && isfinite(v);
+}
+
+// ---------------- rows ----------------
+// A field of the current line. A null `b` means the layout has no such column;
+// a present but empty field has b == e.
+struct Slice {
+    const char* b = nullptr;
+    const char* e = nullptr;
+
+    bool empty() const { return b == e; }
+    size_t size() const { return (size_t)(e - b); }
+};
+
+struct RowFields {
+    Slice zone;
+    Slice dropoff;
+    Slice time;
+    Slice distance;
+    Slice fare;
+};
+
+// Timestamp format of the current input when IngestOptions::timeFormat is
+// Auto: fixed by the first row whose time parses, reset with the schema.
+static TimeFormat activeTime = TimeFormat::Auto;
+
+// Bare epoch seconds are only guessed from 9+ digits (after 1973) so a stray
+// small number can't switch a whole file to epoch mode.
+static TimeFormat guessTime(const Slice& s, const IngestOptions& opt, Stamp& st) {
+    if (parseStamp(s.b, s.e, st)) return TimeFormat::DateTime;
+    if (parseIso(s.b, s.e, opt.utcOffsetMinutes, st)) return TimeFormat::Iso8601;
+    if (s.size() >= 9 && parseEpoch(s.b, s.e, opt.utcOffsetMinutes, st)) return TimeFormat::EpochSeconds;
+    return TimeFormat::Auto;
+}
+
+static inline bool parseTime(const Slice& s, const IngestOptions& opt, Stamp& st) {
+    const TimeFormat fmt = opt.timeFormat == TimeFormat::Auto ? activeTime : opt.timeFormat;
+    switch (fmt) {
+    case TimeFormat::DateTime:
+        return parseStamp(s.b, s.e, st);
+    case TimeFormat::Iso8601:
+        return parseIso(s.b, s.e, opt.utcOffsetMinutes, st);
+    case TimeFormat::EpochSeconds:
+        return parseEpoch(s.b, s.e, opt.utcOffsetMinutes, st);
+    case TimeFormat::Auto:
+        break;
+    }
+    activeTime = guessTime(s, opt, st);
+    return activeTime != TimeFormat::Auto;
+}
+
+// Per-row guess for files whose header isn't recognized: 3 fields means
+// TripID,PickupZoneID,PickupTime, otherwise the 6-column layout.
+// Like every split* function, fills f and returns whether the row is usable.
+static bool splitLine(char* ls, char* le, const IngestOptions& opt, RowFields& f) {
+    if (le > ls && le[-1] == '\r') le--;
+    if (le <= ls) return false;
+
+    char* c1 = (char*)memchr(ls, ',', le - ls);
+    if (!c1) return false;
+
+    char* c2 = (char*)memchr(c1 + 1, ',', le - (c1 + 1));
+    if (!c2 || c2 <= c1 + 1) return false;
+
+    char* c3 = (char*)memchr(c2 + 1, ',', le - (c2 + 1));
+
+    f.zone = {c1 + 1, c2};
+
+    if (!c3) {
+        f.time = {c2 + 1, le};
+    } else {
+        char* c4 = (char*)memchr(c3 + 1, ',', le - (c3 + 1));
+        if (!c4) return false;
+        if (opt.routes) f.dropoff = {c2 + 1, c3};
+        f.time = {c3 + 1, c4};
+
+        const char* c5 = (const char*)memchr(c4 + 1, ',', le - (c4 + 1));
+        f.distance = {c4 + 1, c5 ? c5 : le};
+        if (c5) {
+            const char* c6 = (const char*)memchr(c5 + 1, ',', le - (c5 + 1));
+            f.fare = {c5 + 1, c6 ? c6 : le};
+        } else {
+            f.fare = {le, le};
+        }
+    }
+
+    return !f.time.empty();
+}
+
+// ---------------- schemas ----------------
+// Column positions (0-based, -1 = absent) of a detected header. The common
+// layouts are compile-time constants so the field walk in splitRow folds
+// to straight-line code; GenericLayout covers reordered or extra columns.
+struct Layout6 {
+    static constexpr int zone = 1, dropoff = 2, time = 3, distance = 4, fare = 5, columns = 6;
+};
+
+struct Layout3 {
+    static constexpr int zone = 1, dropoff = -1, time = 2, distance = -1, fare = -1, columns = 3;
+};
+
+struct GenericLayout {
+    int zone = -1, dropoff = -1, time = -1, distance = -1, fare = -1, columns = 0;
+};
+
+enum class SchemaKind { Unknown, Six, Three, Generic };
+
+struct Schema {
+    SchemaKind kind = SchemaKind::Unknown;
+    GenericLayout cols;
+};
+
+// schema of the last header read; ingestRow keeps using it
+static Schema activeSchema;
+
+static Schema detectSchema(const char* ls, const char* le) {
+    if (le > ls && le[-1] == '\r') le--;
+
+    GenericLayout c;
+    int n = 0;
+    for (const char* p = ls; ; ++n) {
+        const char* e = (const char*)memchr(p, ',', (size_t)(le - p));
+        if (!e) e = le;
+
+        const char* b = p;
+        while (b < e && (*b == ' ' || *b == '"' || *b == '\xEF' || *b == '\xBB' || *b == '\xBF')) ++b;
+        const char* x = e;
+        while (x > b && (x[-1] == ' ' || x[-1] == '"')) --x;
+        string name(b, x);
+
+        if (name == "PickupZoneID") c.zone = n;
+        else if (name == "DropoffZoneID") c.dropoff = n;
+        else if (name == "PickupDateTime" || name == "PickupTime") c.time = n;
+        else if (name == "DistanceKm") c.distance = n;
+        else if (name == "FareAmount") c.fare = n;
+
+        if (e == le) break;
+        p = e + 1;
+    }
+    c.columns = n + 1;
+
+    Schema s;
+    s.cols = c;
+    if (c.zone < 0 || c.time < 0) s.kind = SchemaKind::Unknown;
+    else if (c.columns == 6 && c.zone == 1 && c.dropoff == 2 && c.time == 3 && c.distance == 4 && c.fare == 5)
+        s.kind = SchemaKind::Six;
+    else if (c.columns == 3 && c.zone == 1 && c.time == 2)
+        s.kind = SchemaKind::Three;
+    else
+        s.kind = SchemaKind::Generic;
+    return s;
+}
+
+// ---------------- fields ----------------
+// Both readers move p past one field and its delimiter and return false when
+// the field ran to the end of the line.
+static inline bool plainField(char*& p, char* le, Slice& out) {
+    char* e = (char*)memchr(p, ',', (size_t)(le - p));
+    if (!e) {
+        out = {p, le};
+        p = le;
+        return false;
+    }
+    out = {p, e};
+    p = e + 1;
+    return true;
+}
+
+// RFC 4180: a field starting with '"' runs to the matching quote, with ""
+// standing for one '"'. The unescaped text is compacted in place, so the
+// slice stays inside the line. Text between the closing quote and the next
+// delimiter is ignored.
+static inline bool quotedField(char*& p, char* le, Slice& out) {
+    if (p == le || *p != '"') return plainField(p, le, out);
+
+    char* w = p;
+    char* r = p + 1;
+    for (;;) {
+        char* q = (char*)memchr(r, '"', (size_t)(le - r));
+        if (!q) {                       // unterminated: keep the rest
+            memmove(w, r, (size_t)(le - r));
+            w += le - r;
+            r = le;
+            break;
+        }
+        memmove(w, r, (size_t)(q - r));
+        w += q - r;
+        if (q + 1 < le && q[1] == '"') {
+            *w++ = '"';
+            r = q + 2;
+            continue;
+        }
+        r = q + 1;
+        break;
+    }
+    out = {p, w};
+
+    char* e = (char*)memchr(r, ',', (size_t)(le - r));
+    if (!e) {
+        p = le;
+        return false;
+    }
+    p = e + 1;
+    return true;
+}
+
+// Per-row guess for quoted lines under an unrecognized header, mirroring splitLine.
+static bool splitQuotedLine(char* ls, char* le, const IngestOptions& opt, RowFields& f) {
+    if (le > ls && le[-1] == '\r') le--;
+    if (le <= ls) return false;
+
+    Slice cols[6];
+    int n = 0;
+    for (char* p = ls; n < 6; ) {
+        bool more = quotedField(p, le, cols[n++]);
+        if (!more) break;
+    }
+    if (n == 4 || n < 3 || cols[1].empty()) return false;
+
+    f.zone = cols[1];
+    if (n == 3) {
+        f.time = cols[2];
+    } else {
+        if (opt.routes) f.dropoff = cols[2];
+        f.time = cols[3];
+        f.distance = cols[4];
+        f.fare = n > 5 ? cols[5] : Slice{le, le};
+    }
+
+    return !f.time.empty();
+}
+
+// Optional columns a row has to locate, from the active aggregations.
+enum : unsigned { NEED_DROPOFF = 1, NEED_AMOUNTS = 2 };
+
+static unsigned neededColumns(const IngestOptions& opt) {
+    return (opt.routes ? NEED_DROPOFF : 0u) | (opt.metrics || opt.quantiles ? NEED_AMOUNTS : 0u);
+}
+
+// Walks only as far as the last column the active aggregations read; the rest
+// of the line is never looked at (LineReader already found its end).
+// Quoted is chosen per line, only for lines that contain a '"'.
+//
+// Under the two README headers, a row shaped like the other layout is read
+// the way splitLine guesses it: 3 fields under the 6-column header are
+// TripID,PickupZoneID,PickupTime, and 5+ fields under the 3-column header
+// are a 6-column row (4 fields stay rejected).
+template <class L, unsigned Need, bool Quoted>
+static bool splitRow(char* ls, char* le, const L& lay, RowFields& f) {
+    if (le > ls && le[-1] == '\r') le--;
+    if (le <= ls) return false;
+
+    constexpr bool Dropoff = (Need & NEED_DROPOFF) != 0;
+    constexpr bool Amounts = (Need & NEED_AMOUNTS) != 0;
+    constexpr bool Six = is_same<L, Layout6>::value;
+    constexpr bool Three = is_same<L, Layout3>::value;
+    const int required = max(lay.zone, lay.time);
+    int last = required;
+    if (Dropoff) last = max(last, lay.dropoff);
+    if (Amounts) last = max(last, max(lay.distance, lay.fare));
+
+    if (Dropoff && lay.dropoff >= 0) f.dropoff = {le, le};
+    if (Amounts && lay.distance >= 0) f.distance = {le, le};
+    if (Amounts && lay.fare >= 0) f.fare = {le, le};
+
+    char* p = ls;
+    auto next = [&](Slice& field) {
+        return Quoted ? quotedField(p, le, field) : plainField(p, le, field);
+    };
+
+    bool more = true;
+    for (int c = 0; c <= last; ++c) {
+        Slice field;
+        more = next(field);
+
+        if (c == lay.zone) f.zone = field;
+        else if (c == lay.time) f.time = field;
+        else if (Dropoff && c == lay.dropoff) f.dropoff = field;
+        else if (Amounts && c == lay.distance) f.distance = field;
+        else if (Amounts && c == lay.fare) f.fare = field;
+
+        // a row cut short before the last required column, or right after it
+        // when the header promises more, is malformed
+        if (!more) {
+            if (Six && c == 2) {
+                f.time = field;
+                f.dropoff = f.distance = f.fare = Slice{};
+                break;
+            }
+            if (c < required || (c == required && required < lay.columns - 1)) return false;
+            break;
+        }
+    }
+
+    if (Three && more) {
+        Slice field;
+        if (!next(field)) return false;
+        if (Dropoff) f.dropoff = f.time;
+        f.time = field;
+        if (Amounts) {
+            f.fare = {le, le};
+            if (next(f.distance)) next(f.fare);
+        }
+    }
+
+    return !f.zone.empty() && !f.time.empty();
+}
+
+// One line under the active schema.
+template <class L, unsigned Need>
+static inline bool dispatchRow(char* ls, char* le, bool quoted, const L& lay, RowFields& f) {
+    return quoted ? splitRow<L, Need, true>(ls, le, lay, f) : splitRow<L, Need, false>(ls, le, lay, f);
+}
+
+static inline bool dispatchLine(char* ls, char* le, bool quoted, const IngestOptions& opt, RowFields& f) {
+    return quoted ? splitQuotedLine(ls, le, opt, f) : splitLine(ls, le, opt, f);
+}
+
+template <unsigned N>
+using Needs = integral_constant<unsigned, N>;
+
+// Calls fn(layout, need) with the layout type and needed-column set
+// instantiated for `s`.
+template <class L, class F>
+static void withNeeds(const L& lay, unsigned need, F&& fn) {
+    switch (need) {
+    case 0: fn(lay, Needs<0>{}); break;
+    case NEED_DROPOFF: fn(lay, Needs<NEED_DROPOFF>{}); break;
+    case NEED_AMOUNTS: fn(lay, Needs<NEED_AMOUNTS>{}); break;
+    default: fn(lay, Needs<NEED_DROPOFF | NEED_AMOUNTS>{}); break;
+    }
+}
+
+template <class F>
+static void withLayout(const Schema& s, unsigned need, F&& fn) {
+    switch (s.kind) {
+    case SchemaKind::Six:
+        withNeeds(Layout6{}, need, fn);
+        break;
+    case SchemaKind::Three:
+        withNeeds(Layout3{}, need, fn);
+        break;
+    case SchemaKind::Generic:
+        withNeeds(s.cols, need, fn);
+        break;
+    case SchemaKind::Unknown:
+        break;
+    }
+}
+
+// ---------------- batches ----------------
+// Rows are aggregated a block at a time. The parsing side resolves each row
+// into one entry of a structure-of-arrays Columns block; when the block is
+// full, every kernel in KERNELS runs over it, each a tight loop over the
+// columns it needs. A new aggregation is a new kernel (plus a column if it
+// needs one) and never touches the parser.
+struct Columns {
+    static const size_t SIZE = 8192;
+
+    // amount values; a row whose layout has amount columns but whose value
+    // is missing or unreadable stores BAD, a row without amount columns NONE
+    static constexpr double BAD = -1.0;
+    static constexpr double NONE = -2.0;
+
+    int32_t zone[SIZE];
+    int32_t drop[SIZE];         // -1: no route
+    int32_t day[SIZE];
+    uint8_t hour[SIZE];
+    double distance[SIZE];
+    double fare[SIZE];
+    size_t n = 0;
+};
+
+using Kernel = void (*)(const Columns&, Tables&, const IngestOptions&);
+
+static void countZones(const Columns& c, Tables& t, const IngestOptions&) {
+    long long* counts = t.zoneCounts.data();
+    array<long long, 24>* slots = t.slotCounts.data();
+    if (t.live.active) {
+        for (size_t i = 0; i < c.n; ++i) {
+            slots[c.zone[i]][c.hour[i]]++;
+            t.live.bump(c.zone[i], ++counts[c.zone[i]]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < c.n; ++i) {
+        counts[c.zone[i]]++;
+        slots[c.zone[i]][c.hour[i]]++;
+    }
+}
+
+static void countRoutes(const Columns& c, Tables& t, const IngestOptions&) {
+    for (size_t i = 0; i < c.n; ++i)
+        if (c.drop[i] >= 0) t.routes.add(CountTable::pack(c.zone[i], c.drop[i]));
+}
+
+static void countDays(const Columns& c, Tables& t, const IngestOptions& opt) {
+    if (!opt.dayPartitions) return;
+    for (size_t i = 0; i < c.n; ++i)
+        t.partition(c.day[i]).slots.add(DayPartition::key(c.zone[i], c.hour[i]));
+}
+
+// DistanceKm and FareAmount; each is rejected on its own.
+static void addMetrics(const Columns& c, Tables& t, const IngestOptions& opt) {
+    if (!opt.metrics && !opt.quantiles) return;
+
+    Metrics& m = t.metrics;
+    if (opt.metrics) m.fit(t.zoneNames.size());
+    if (opt.quantiles && t.sketches.zones.size() < t.zoneNames.size())
+        t.sketches.zones.resize(t.zoneNames.size());
+
+    for (size_t i = 0; i < c.n; ++i) {
+        const double km = c.distance[i];
+        if (km == Columns::NONE) continue;
+        const int id = c.zone[i];
+        const int hour = c.hour[i];
+
+        if (km >= 0) {
+            if (opt.metrics) m.distance[id] += km;
+            if (opt.quantiles) {
+                t.sketches.zones[id].distance.add(km);
+                t.sketches.hours[hour].distance.add(km);
+            }
+        } else {
+            m.badDistance++;
+        }
+
+        const double fare = c.fare[i];
+        if (fare >= 0) {
+            if (opt.metrics) {
+                m.revenue[id] += fare;
+                m.fareSum[id][hour] += fare;
+                m.fareTrips[id][hour]++;
+            }
+            if (opt.quantiles) {
+                t.sketches.zones[id].fare.add(fare);
+                t.sketches.hours[hour].fare.add(fare);
+            }
+        } else {
+            m.badFare++;
+        }
+    }
+}
+
+static const Kernel KERNELS[] = {countZones, countRoutes, addMetrics, countDays};
+
+static Columns columns;
+
+static void runKernels(Tables& t, const IngestOptions& opt) {
+    for (Kernel k : KERNELS) k(columns, t, opt);
+    columns.n = 0;
+}
+
+static inline double amount(const Slice& s) {
+    double v;
+    return s.b && parseAmount(s.b, s.e, v) ? v : Columns::BAD;
+}
+
+// Front end of the column block: located rows wait here in groups of up to
+// SIZE so the dictionary misses of one row overlap those of the others:
+//   add()     parse the time, hash the zone names, prefetch their dictionary slots
+//   flush()   resolve zone ids in row order (ids are handed out exactly as
+//             row-at-a-time interning would) and append the rows to `columns`
+// Slices point into the caller's line buffer, which must stay put until flush().
+class RowBatch {
+public:
+    static const size_t SIZE = 64;
+
+    bool empty() const { return n == 0; }
+
+    void add(const RowFields& f, Tables& t, const IngestOptions& opt) {
+        Row& r = rows[n];
+        if (!parseTime(f.time, opt, r.st)) return;
+        r.f = f;
+        r.zoneHash = hashKey(f.zone.b, f.zone.size());
+        t.zoneIds.prefetch(r.zoneHash);
+        r.hasDrop = f.dropoff.b && !f.dropoff.empty();   // an empty dropoff only skips the route
+        if (r.hasDrop) {
+            r.dropHash = hashKey(f.dropoff.b, f.dropoff.size());
+            t.zoneIds.prefetch(r.dropHash);
+        }
+        if (++n == SIZE) flush(t, opt);
+    }
+
+    void flush(Tables& t, const IngestOptions& opt) {
+        const bool amounts = opt.metrics || opt.quantiles;
+        for (size_t i = 0; i < n; ++i) {
+            const Row& r = rows[i];
+            Columns& c = columns;
+            const size_t k = c.n;
+            c.zone[k] = t.internPickup(r.f.zone.b, r.f.zone.size(), r.zoneHash);
+            c.drop[k] = r.hasDrop ? t.intern(r.f.dropoff.b, r.f.dropoff.size(), r.dropHash) : -1;
+            c.day[k] = r.st.day;
+            c.hour[k] = (uint8_t)r.st.hour;
+
+            // layouts without amount columns (3-column files) have nothing to reject
+            if (amounts && (r.f.distance.b || r.f.fare.b)) {
+                c.distance[k] = amount(r.f.distance);
+                c.fare[k] = amount(r.f.fare);
+            } else {
+                c.distance[k] = c.fare[k] = Columns::NONE;
+            }
+            if (++c.n == Columns::SIZE) runKernels(t, opt);
+        }
+        n = 0;
+    }
+
+private:
+    struct Row {
+        RowFields f;
+        Stamp st;
+        uint64_t zoneHash;
+        uint64_t dropHash;
+        bool hasDrop;
+    };
+
+    Row rows[SIZE];
+    size_t n = 0;
+};
+
+// ---------------- input ----------------
+// Splits a FILE* into lines through one fixed buffer. A line longer than the
+// buffer can't be a valid row; it is dropped up to its newline.
+//
+// Each refill checks the buffered bytes for '"' once. Blocks without one are
+// split with plain memchr; otherwise rows are found with a quote-aware scan so
+// a newline inside a quoted field doesn't end the row, and `quoted` tells the
+// caller which rows need the quote-aware field reader. A quoted field only
+// spans lines when its closing quote is found and ends the field; a stray
+// quote keeps its row to the physical line.
+class LineReader {
+public:
+    // huge: read through one 2 MiB huge-page block instead of the 64 KiB static buffer
+    LineReader(FILE* in, bool huge) : in(in) {
+        if (huge) {
+            buffer = (char*)allocBlock(HUGE_PAGE);
+            cap = HUGE_PAGE;
+        }
+        cur = end = buffer;
+    }
+
+    ~LineReader() {
+        if (buffer != staticBuffer) freeBlock(buffer, cap);
+    }
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    bool next(char*& ls, char*& le, bool& quoted) {
+        for (;;) {
+            scan();
+            quoted = nlQuoted;
+            if (nl) {
+                char* s = cur;
+                cur = nl + 1;
+                scanned = false;
+                if (dropping) {
+                    dropping = false;
+                    continue;
+                }
+                ls = s;
+                le = nl;
+                return true;
+            }
+            if (eof) {
+                if (cur == end || dropping) return false;
+                ls = cur;
+                le = end;
+                cur = end;
+                return true;
+            }
+            refill();
+        }
+    }
+
+    // True when next() can return without refilling, i.e. lines handed out so
+    // far stay valid through the next call. The scan is reused by next().
+    bool buffered() {
+        scan();
+        return nl || eof;
+    }
+
+private:
+    static const size_t BUF = 1 << 16;
+
+    void refill() {
+        size_t left = (size_t)(end - cur);
+        if (left == cap) {
+            dropping = true;
+            left = 0;
+        }
+        memmove(buffer, cur, left);
+        size_t got = fread(buffer + left, 1, cap - left, in);
+        cur = buffer;
+        end = buffer + left + got;
+        if (got == 0) eof = true;
+        quotes = memchr(buffer, '"', (size_t)(end - buffer)) != nullptr;
+        scanned = false;
+    }
+
+    // Finds the end of the row at cur once per row.
+    void scan() {
+        if (scanned) return;
+        nlQuoted = false;
+        nl = quotes ? rowEnd(nlQuoted) : (char*)memchr(cur, '\n', (size_t)(end - cur));
+        scanned = true;
+    }
+
+    // Newline ending the row at cur, or null if the row isn't complete in the
+    // buffer. A '"' opens a quoted field only at the start of a field.
+    char* rowEnd(bool& quoted) {
+        bool inQuotes = false;
+        bool fieldStart = true;
+        char* brk = nullptr;            // first newline inside the open quoted field
+        quoted = false;
+        for (char* p = cur; p < end; ++p) {
+            char ch = *p;
+            if (inQuotes) {
+                if (ch == '\n' && !brk) brk = p;
+                if (ch != '"') continue;
+                if (p + 1 == end && !eof) return full() ? brk : nullptr;   // "" may straddle the refill
+                if (p + 1 < end && p[1] == '"') {
+                    ++p;
+                    continue;
+                }
+                inQuotes = false;
+                // a field spanning lines must close right before a delimiter
+                if (brk && p + 1 < end && p[1] != ',' && p[1] != '\r' && p[1] != '\n') return brk;
+                brk = nullptr;
+                continue;
+            }
+            if (ch == '\n') return p;
+            if (ch == '"' && fieldStart) {
+                inQuotes = true;
+                quoted = true;
+            }
+            fieldStart = ch == ',';
+        }
+        // no closing quote anywhere the row could still end: the quote was stray
+        return eof || full() ? brk : nullptr;
+    }
+
+    // The row at cur fills the whole buffer, so a refill can't complete it.
+    bool full() const {
+        return cur == buffer && end == buffer + cap;
+    }
+
+    alignas(CACHE_LINE) static char staticBuffer[BUF];
+    FILE* in;
+    char* buffer = staticBuffer;
+    size_t cap = BUF;
+    char* cur;
+    char* end;
+    bool eof = false;
+    bool dropping = false;
+    bool quotes = false;
+    bool scanned = false;
+    char* nl = nullptr;             // end of the row at cur, once scanned
+    bool nlQuoted = false;
+};
+
+alignas(CACHE_LINE) char LineReader::staticBuffer[LineReader::BUF];
+
+static RowBatch batch;
+
+static void ingestStream(FILE* in, Tables& t, const IngestOptions& opt) {
+    LineReader reader(in, opt.hugePages);
+    char* ls;
+    char* le;
+    bool quoted;
+    if (!reader.next(ls, le, quoted)) return;   // header
+
+    // rows are batched only while the reader's buffer holds still
+    auto add = [&](bool ok, const RowFields& f) {
+        if (ok) batch.add(f, t, opt);
+        if (!batch.empty() && !reader.buffered()) batch.flush(t, opt);
+    };
+
+    activeSchema = detectSchema(ls, le);
+    if (activeSchema.kind == SchemaKind::Unknown) {
+        while (reader.next(ls, le, quoted)) {
+            RowFields f;
+            add(dispatchLine(ls, le, quoted, opt, f), f);
+        }
+    } else {
+        withLayout(activeSchema, neededColumns(opt), [&](const auto& lay, auto need) {
+            using L = decay_t<decltype(lay)>;
+            while (reader.next(ls, le, quoted)) {
+                RowFields f;
+                add(dispatchRow<L, decltype(need)::value>(ls, le, quoted, lay, f), f);
+            }
+        });
+    }
+    batch.flush(t, opt);
+    runKernels(t, opt);
+}
+
+// ---------------- TripAnalyzer ----------------
+void TripAnalyzer::enableTripMetrics(bool on) {
+    options.metrics = on;
+}
+
+void TripAnalyzer::enableQuantiles(bool on) {
+    options.quantiles = on;
+}
+
+void TripAnalyzer::enableLiveRanking(bool on) {
+    options.liveRanking = on;
+}
+
+void TripAnalyzer::enableRoutes(bool on) {
+    options.routes = on;
+}
+
+void TripAnalyzer::enableDayPartitions(bool on) {
+    options.dayPartitions = on;
+}
+
+void TripAnalyzer::enableHugePages(bool on) {
+    options.hugePages = on;
+}
+
+void TripAnalyzer::setTimeFormat(TimeFormat format, int utcOffsetMinutes) {
+    options.timeFormat = format;
+    options.utcOffsetMinutes = utcOffsetMinutes;
+}
+
+void TripAnalyzer::reset() {
+    tables.clear();
+    activeSchema = Schema();
+    activeTime = TimeFormat::Auto;
+}
+
+// Tables grown from here on follow the option; existing blocks keep their pages.
+static void applyPages(const IngestOptions& opt) {
+    hugePages = opt.hugePages;
+}
 
-// ---------------- helpers ----------------
-static inline bool is_digit(char c) {
-    return c >= '0' && c <= '9';
+// Live ranking is switched on lazily at the first ingest that asks for it.
+static void applyLive(Tables& t, const IngestOptions& opt) {
+    if (opt.liveRanking && !t.live.active) t.live.seed(t.zoneCounts);
+    else if (!opt.liveRanking && t.live.active) t.live.clear();
 }
 
-static int parseHour(const char* ts, const char* te) {
-    if (te > ts && te[-1] == '\r') te--;
+void TripAnalyzer::ingestFile(const string& path) {
+    tables.clear();
+    activeSchema = Schema();
+    activeTime = TimeFormat::Auto;
+    applyPages(options);
+    applyLive(tables, options);
+
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) return;
 
-    const char* sp = (const char*)memchr(ts, ' ', (size_t)(te - ts));
-    if (!sp || sp + 2 >= te) return -1;
+    ingestStream(in, tables, options);
+    fclose(in);
+}
 
-    char h1 = sp[1];
-    char h2 = sp[2];
-    if (!is_digit(h1) || !is_digit(h2)) return -1;
+void TripAnalyzer::ingestStdin() {
+    tables.clear();
+    activeSchema = Schema();
+    activeTime = TimeFormat::Auto;
+    applyPages(options);
+    applyLive(tables, options);
 
-    int hour = (h1 - '0') * 10 + (h2 - '0');
-    return (hour >= 0 && hour <= 23) ? hour : -1;
+    ingestStream(stdin, tables, options);
 }
 
-static void processLine(
-    char* ls, char* le,
-    unordered_map<string, long long>& zc,
-    unordered_map<string, array<long long, 24>>& sc
-) {
-    if (le > ls && le[-1] == '\r') le--;
-    if (le <= ls) return;
+void TripAnalyzer::ingestRow(const string& csvRow) {
+    static string row;
+    row.assign(csvRow);
+    if (!row.empty() && row.back() == '\n') row.pop_back();
 
-    char* c1 = (char*)memchr(ls, ',', le - ls);
-    if (!c1) return;
+    applyPages(options);
+    applyLive(tables, options);
+    tables.generation++;
+    if (row.empty()) return;
 
-    char* c2 = (char*)memchr(c1 + 1, ',', le - (c1 + 1));
-    if (!c2 || c2 <= c1 + 1) return;
+    char* ls = &row[0];
+    char* le = ls + row.size();
+    bool quoted = row.find('"') != string::npos;
+    RowFields f;
+    bool ok = false;
+    if (activeSchema.kind == SchemaKind::Unknown) {
+        ok = dispatchLine(ls, le, quoted, options, f);
+    } else {
+        withLayout(activeSchema, neededColumns(options), [&](const auto& lay, auto need) {
+            ok = dispatchRow<decay_t<decltype(lay)>, decltype(need)::value>(ls, le, quoted, lay, f);
+        });
+    }
+    if (!ok) return;
+    batch.add(f, tables, options);
+    batch.flush(tables, options);
+    runKernels(tables, options);
+}
 
-    char* c3 = (char*)memchr(c2 + 1, ',', le - (c2 + 1));
+// ---------------- ranking ----------------
+// Bounded selection: a heap of the k best items seen so far, worst on top,
+// so picking k out of m costs O(m log k) and never sorts the rest.
+template <class T, class Better>
+class TopK {
+public:
+    TopK(size_t k, Better better) : k(k), better(better) {}
 
-    const char* timeStart = nullptr;
-    const char* timeEnd   = nullptr;
+    void offer(const T& x) {
+        if (heap.size() < k) {
+            heap.push_back(x);
+            push_heap(heap.begin(), heap.end(), better);
+        } else if (k > 0 && better(x, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = x;
+            push_heap(heap.begin(), heap.end(), better);
+        }
+    }
 
-    if (!c3) {
-        timeStart = c2 + 1;
-        timeEnd   = le;
-    } else {
-        char* c4 = (char*)memchr(c3 + 1, ',', le - (c3 + 1));
-        if (!c4) return;
-        timeStart = c3 + 1;
-        timeEnd   = c4;
+    // Best first.
+    vector<T> take() {
+        sort_heap(heap.begin(), heap.end(), better);
+        return move(heap);
     }
 
-    if (timeEnd <= timeStart) return;
+private:
+    size_t k;
+    Better better;
+    vector<T> heap;
+};
+
+template <class T, class Better>
+static TopK<T, Better> makeTopK(int k, Better better) {
+    return TopK<T, Better>((size_t)max(k, 0), better);
+}
 
-    int hour = parseHour(timeStart, timeEnd);
-    if (hour < 0) return;
+struct ZoneHit {
+    long long count;
+    int id;
+};
 
-    string zone(c1 + 1, (size_t)(c2 - (c1 + 1)));
+struct SlotHit {
+    long long count;
+    int id;
+    int hour;
+};
 
-    zc[zone]++;
-    sc[zone][hour]++;
+static bool betterZone(const ZoneHit& a, const ZoneHit& b) {
+    if (a.count != b.count) return a.count > b.count;
+    return tables.zoneNames[a.id] < tables.zoneNames[b.id];
 }
 
-// ---------------- TripAnalyzer ----------------
-void TripAnalyzer::ingestFile(const string& path) {
-    zoneCounts.clear();
-    slotCounts.clear();
+static bool betterSlot(const SlotHit& a, const SlotHit& b) {
+    if (a.count != b.count) return a.count > b.count;
+    if (a.id != b.id) return tables.zoneNames[a.id] < tables.zoneNames[b.id];
+    return a.hour < b.hour;
+}
+
+static void rankZones(vector<ZoneCount>& res, int k) {
+    sort(res.begin(), res.end(),
+         [](const ZoneCount& a, const ZoneCount& b) {
+             if (a.count != b.count) return a.count > b.count;
+             return a.zone < b.zone;
+         });
+
+    if ((int)res.size() > k) res.resize(max(k, 0));
+}
+
+static void rankSlots(vector<SlotCount>& res, int k) {
+    sort(res.begin(), res.end(),
+         [](const SlotCount& a, const SlotCount& b) {
+             if (a.count != b.count) return a.count > b.count;
+             if (a.zone != b.zone) return a.zone < b.zone;
+             return a.hour < b.hour;
+         });
 
-    ifstream file(path);
-    if (!file.is_open()) return;
+    if ((int)res.size() > k) res.resize(max(k, 0));
+}
 
-    string line;
-    if (!getline(file, line)) return; // header
+// Resolves an inclusive "YYYY-MM-DD" range to the partitions it covers.
+static bool dayRange(const string& from, const string& to,
+                     map<int, DayPartition>::const_iterator& first,
+                     map<int, DayPartition>::const_iterator& last) {
+    int d0, d1;
+    if (from.size() != 10 || to.size() != 10) return false;
+    if (!parseDay(from.data(), from.data() + from.size(), d0)) return false;
+    if (!parseDay(to.data(), to.data() + to.size(), d1)) return false;
+    if (d0 > d1) return false;
 
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        processLine(&line[0], &line[0] + line.size(), zoneCounts, slotCounts);
-    }
+    first = tables.days.lower_bound(d0);
+    last  = tables.days.upper_bound(d1);
+    return true;
 }
 
-void TripAnalyzer::ingestStdin() {
-    zoneCounts.clear();
-    slotCounts.clear();
+// Full orders over zone ids / (zone, hour) pairs, rebuilt at most once per
+// generation; any k is then a prefix slice of the cached order.
+//
+// Orders are built without string comparisons: each zone gets its
+// lexicographic rank once, then (inverted count, zone rank[, hour]) is packed
+// into one 64-bit key whose ascending order is exactly the ranking order, and
+// the keys are LSD radix sorted.
+struct SlotKey {
+    int id;
+    int hour;
+};
 
-    const size_t BUF = 1 << 16;
-    static char buffer[BUF];
-    size_t leftover = 0;
+struct RankCache {
+    unsigned long long zonesGen = 0;
+    unsigned long long slotsGen = 0;
+    unsigned long long indexGen = 0;
+    vector<int> zones;
+    vector<SlotKey> slots;
+    vector<int> rankOfId;       // zone id -> 1-based rank, 0 = no pickups
 
-    while (true) {
-        size_t bytesRead = fread(buffer + leftover, 1, BUF - leftover, stdin);
+    // lexicographic order of the zone dictionary; survives ingests that add no zones
+    unsigned long long namesEpoch = 0;
+    vector<int> byName;         // name rank -> zone id
+    vector<uint32_t> nameRank;  // zone id -> name rank
+};
 
-        if (bytesRead == 0) {
-            if (leftover > 0)
-                processLine(buffer, buffer + leftover, zoneCounts, slotCounts);
-            break;
+static RankCache ranks;
+
+static void rankNames() {
+    const auto& names = tables.zoneNames;
+    if (ranks.namesEpoch == tables.epoch && ranks.byName.size() == names.size()) return;
+
+    ranks.byName.resize(names.size());
+    for (size_t id = 0; id < names.size(); ++id) ranks.byName[id] = (int)id;
+    sort(ranks.byName.begin(), ranks.byName.end(),
+         [&](int a, int b) { return names[a] < names[b]; });
+
+    ranks.nameRank.resize(names.size());
+    for (size_t r = 0; r < names.size(); ++r) ranks.nameRank[ranks.byName[r]] = (uint32_t)r;
+
+    ranks.namesEpoch = tables.epoch;
+}
+
+static int bitWidth(uint64_t v) {
+    int b = 0;
+    while (v) { b++; v >>= 1; }
+    return b;
+}
+
+// LSD radix sort on the low `bits` bits, 8 bits per pass. Passes whose digit
+// is the same for every key are skipped.
+static void radixSort(uint64_t* keys, size_t n, int bits) {
+    if (n < 2) return;
+
+    vector<uint64_t> tmp(n);
+    uint64_t* src = keys;
+    uint64_t* dst = tmp.data();
+    for (int shift = 0; shift < bits; shift += 8) {
+        size_t hist[256] = {0};
+        for (size_t i = 0; i < n; ++i) hist[(src[i] >> shift) & 0xFF]++;
+        if (hist[(src[0] >> shift) & 0xFF] == n) continue;
+
+        size_t pos = 0;
+        for (size_t& h : hist) {
+            size_t c = h;
+            h = pos;
+            pos += c;
         }
+        for (size_t i = 0; i < n; ++i) dst[hist[(src[i] >> shift) & 0xFF]++] = src[i];
+        swap(src, dst);
+    }
+    if (src != keys) memcpy(keys, src, n * sizeof(uint64_t));
+}
 
-        size_t dataSize = leftover + bytesRead;
-        char* cur = buffer;
-        char* end = buffer + dataSize;
-        char* lineStart = cur;
+// Full rankings with at least this many entries are sorted on all cores.
+static const size_t PARALLEL_SORT_MIN = 1 << 20;
 
-        while (cur < end) {
-            char* nl = (char*)memchr(cur, '\n', end - cur);
-            if (!nl) {
-                leftover = end - lineStart;
-                memmove(buffer, lineStart, leftover);
-                break;
+// Overrides set by setParallelSortForTesting; workers 0 means one per core.
+static size_t parallelSortMin = PARALLEL_SORT_MIN;
+static unsigned parallelSortWorkers = 0;
+
+void setParallelSortForTesting(size_t minKeys, unsigned workers) {
+    parallelSortMin = max<size_t>(minKeys, 1);
+    parallelSortWorkers = workers;
+}
+
+static unsigned sortWorkers(size_t n) {
+    if (n < parallelSortMin) return 1;
+    if (parallelSortWorkers) return (unsigned)min<size_t>(parallelSortWorkers, n);
+    unsigned hw = thread::hardware_concurrency();
+    if (hw < 2) return 1;
+    return (unsigned)min<size_t>(hw, n / max<size_t>(parallelSortMin / 4, 1));
+}
+
+// Sorts contiguous chunks concurrently with sortRange, then merges adjacent
+// runs pairwise (each round in parallel) until one run is left. The orders
+// used here are strict total orders, so the result is the single-threaded one.
+template <class T, class SortRange, class Less>
+static void parallelSort(vector<T>& v, SortRange sortRange, Less less) {
+    const size_t n = v.size();
+    const unsigned workers = sortWorkers(n);
+    if (workers <= 1) {
+        sortRange(v.data(), v.data() + n);
+        return;
+    }
+
+    vector<size_t> bounds(workers + 1);
+    for (unsigned w = 0; w <= workers; ++w) bounds[w] = n * w / workers;
+
+    vector<thread> pool;
+    for (unsigned w = 0; w < workers; ++w)
+        pool.emplace_back([&, w] { sortRange(v.data() + bounds[w], v.data() + bounds[w + 1]); });
+    for (auto& t : pool) t.join();
+
+    vector<T> buf(n);
+    T* src = v.data();
+    T* dst = buf.data();
+    while (bounds.size() > 2) {
+        vector<size_t> next;
+        pool.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            const size_t a = bounds[i];
+            next.push_back(a);
+            if (i + 2 < bounds.size()) {
+                const size_t m = bounds[i + 1], b = bounds[i + 2];
+                pool.emplace_back([=] { merge(src + a, src + m, src + m, src + b, dst + a, less); });
+            } else {
+                const size_t b = bounds[i + 1];
+                pool.emplace_back([=] { copy(src + a, src + b, dst + a); });
             }
+        }
+        next.push_back(n);
+        for (auto& t : pool) t.join();
+        bounds.swap(next);
+        swap(src, dst);
+    }
+    if (src != v.data()) copy(src, src + n, v.data());
+}
+
+static void sortKeys(vector<uint64_t>& keys, int bits) {
+    parallelSort(keys, [bits](uint64_t* b, uint64_t* e) { radixSort(b, (size_t)(e - b), bits); },
+                 less<uint64_t>());
+}
+
+static const vector<int>& rankedZones() {
+    if (ranks.zonesGen == tables.generation) return ranks.zones;
+
+    const auto& counts = tables.zoneCounts;
+    const auto& names = tables.zoneNames;
+    vector<int>& order = ranks.zones;
+    order.clear();
+
+    long long maxCount = 0;
+    for (long long c : counts) maxCount = max(maxCount, c);
+
+    const int rankBits = bitWidth(names.size());
+    const int countBits = bitWidth((uint64_t)maxCount);
+    if (rankBits + countBits <= 64) {
+        rankNames();
+        vector<uint64_t> keys;
+        for (size_t id = 0; id < names.size(); ++id)
+            if (counts[id] > 0)   // dropoff-only zones have no pickups
+                keys.push_back((uint64_t)(maxCount - counts[id]) << rankBits | ranks.nameRank[id]);
+
+        sortKeys(keys, rankBits + countBits);
+
+        const uint64_t rankMask = (1ULL << rankBits) - 1;
+        order.reserve(keys.size());
+        for (uint64_t k : keys) order.push_back(ranks.byName[k & rankMask]);
+    } else {
+        for (size_t id = 0; id < names.size(); ++id)
+            if (counts[id] > 0)
+                order.push_back((int)id);
+
+        auto better = [&](int a, int b) {
+            if (counts[a] != counts[b]) return counts[a] > counts[b];
+            return names[a] < names[b];
+        };
+        parallelSort(order, [&](int* b, int* e) { sort(b, e, better); }, better);
+    }
+
+    ranks.zonesGen = tables.generation;
+    return order;
+}
+
+static const vector<SlotKey>& rankedSlots() {
+    if (ranks.slotsGen == tables.generation) return ranks.slots;
+
+    const auto& sc = tables.slotCounts;
+    const auto& names = tables.zoneNames;
+    vector<SlotKey>& order = ranks.slots;
+    order.clear();
+
+    long long maxCount = 0;
+    for (const auto& row : sc)
+        for (long long c : row) maxCount = max(maxCount, c);
 
-            processLine(lineStart, nl, zoneCounts, slotCounts);
-            cur = nl + 1;
-            lineStart = cur;
-            leftover = 0;
+    const int rankBits = bitWidth(names.size());
+    const int countBits = bitWidth((uint64_t)maxCount);
+    if (rankBits + countBits + 5 <= 64) {
+        rankNames();
+        vector<uint64_t> keys;
+        for (size_t id = 0; id < names.size(); ++id) {
+            uint64_t zone = (uint64_t)ranks.nameRank[id] << 5;
+            for (int h = 0; h < 24; ++h)
+                if (sc[id][h] > 0)
+                    keys.push_back((uint64_t)(maxCount - sc[id][h]) << (rankBits + 5) | zone | (uint64_t)h);
         }
+
+        sortKeys(keys, rankBits + countBits + 5);
+
+        const uint64_t rankMask = (1ULL << rankBits) - 1;
+        order.reserve(keys.size());
+        for (uint64_t k : keys) order.push_back({ranks.byName[(k >> 5) & rankMask], (int)(k & 31)});
+    } else {
+        for (size_t id = 0; id < names.size(); ++id)
+            for (int h = 0; h < 24; ++h)
+                if (sc[id][h] > 0)
+                    order.push_back({(int)id, h});
+
+        auto better = [&](const SlotKey& a, const SlotKey& b) {
+            long long ca = sc[a.id][a.hour], cb = sc[b.id][b.hour];
+            if (ca != cb) return ca > cb;
+            if (a.id != b.id && names[a.id] != names[b.id]) return names[a.id] < names[b.id];
+            return a.hour < b.hour;
+        };
+        parallelSort(order, [&](SlotKey* b, SlotKey* e) { sort(b, e, better); }, better);
     }
+
+    ranks.slotsGen = tables.generation;
+    return order;
+}
+
+static const vector<int>& rankIndex() {
+    if (ranks.indexGen == tables.generation) return ranks.rankOfId;
+
+    const vector<int>& order = rankedZones();
+    ranks.rankOfId.assign(tables.zoneNames.size(), 0);
+    for (size_t i = 0; i < order.size(); ++i)
+        ranks.rankOfId[order[i]] = (int)i + 1;
+
+    ranks.indexGen = tables.generation;
+    return ranks.rankOfId;
+}
+
+static int zoneId(const string& zone) {
+    return tables.find(zone.data(), zone.size());
+}
+
+long long TripAnalyzer::countOf(const string& zone) const {
+    int id = zoneId(zone);
+    return id < 0 ? 0 : tables.zoneCounts[id];
+}
+
+long long TripAnalyzer::countOf(const string& zone, int hour) const {
+    int id = zoneId(zone);
+    if (id < 0 || hour < 0 || hour > 23) return 0;
+    return tables.slotCounts[id][hour];
+}
+
+int TripAnalyzer::rankOf(const string& zone) const {
+    int id = zoneId(zone);
+    return id < 0 ? 0 : rankIndex()[id];
 }
 
-// ---------------- ranking ----------------
 vector<ZoneCount> TripAnalyzer::topZones(int k) const {
+    if (!tables.live.active) return zonesPage(0, (size_t)max(k, 0));
+
+    vector<ZoneCount> res;
+    tables.live.forTop((size_t)max(k, 0), [&](int id, long long count) {
+        res.push_back({tables.zoneNames[id], count});
+    });
+    return res;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
+    return slotsPage(0, (size_t)max(k, 0));
+}
+
+// ---------------- pages ----------------
+// Slices of the cached orders: O(pageSize) per page and identical across
+// calls until the next ingest bumps the generation.
+static vector<ZoneCountRef> zoneRefs(size_t offset, size_t pageSize) {
+    const vector<int>& order = rankedZones();
+    size_t first = min(offset, order.size());
+    size_t last = first + min(pageSize, order.size() - first);
+
+    vector<ZoneCountRef> res;
+    res.reserve(last - first);
+    for (size_t i = first; i < last; ++i) {
+        int id = order[i];
+        res.push_back({(unsigned)id, tables.zoneNames[id], tables.zoneCounts[id]});
+    }
+    return res;
+}
+
+static vector<SlotCountRef> slotRefs(size_t offset, size_t pageSize) {
+    const vector<SlotKey>& order = rankedSlots();
+    size_t first = min(offset, order.size());
+    size_t last = first + min(pageSize, order.size() - first);
+
+    vector<SlotCountRef> res;
+    res.reserve(last - first);
+    for (size_t i = first; i < last; ++i) {
+        const SlotKey& s = order[i];
+        res.push_back({(unsigned)s.id, tables.zoneNames[s.id], s.hour, tables.slotCounts[s.id][s.hour]});
+    }
+    return res;
+}
+
+vector<ZoneCount> TripAnalyzer::zonesPage(size_t offset, size_t pageSize) const {
+    vector<ZoneCount> res;
+    for (const ZoneCountRef& z : zoneRefs(offset, pageSize))
+        res.push_back({string(z.zone), z.count});
+    return res;
+}
+
+vector<SlotCount> TripAnalyzer::slotsPage(size_t offset, size_t pageSize) const {
+    vector<SlotCount> res;
+    for (const SlotCountRef& s : slotRefs(offset, pageSize))
+        res.push_back({string(s.zone), s.hour, s.count});
+    return res;
+}
+
+vector<ZoneCountRef> TripAnalyzer::topZoneRefs(int k) const {
+    return zoneRefs(0, (size_t)max(k, 0));
+}
+
+vector<SlotCountRef> TripAnalyzer::topSlotRefs(int k) const {
+    return slotRefs(0, (size_t)max(k, 0));
+}
+
+string_view TripAnalyzer::zoneName(unsigned id) const {
+    return id < tables.zoneNames.size() ? string_view(tables.zoneNames[id]) : string_view();
+}
+
+size_t TripAnalyzer::zoneRankingSize() const {
+    return rankedZones().size();
+}
+
+size_t TripAnalyzer::slotRankingSize() const {
+    return rankedSlots().size();
+}
+
+unsigned long long TripAnalyzer::rankingGeneration() const {
+    return tables.generation;
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(const string& fromDate, const string& toDate, int k) const {
+    vector<ZoneCount> res;
+    map<int, DayPartition>::const_iterator first, last;
+    if (!dayRange(fromDate, toDate, first, last)) return res;
+
+    unordered_map<int, long long> totals;
+    for (auto it = first; it != last; ++it)
+        it->second.slots.forEach([&](uint64_t key, long long c) {
+            totals[DayPartition::zoneOf(key)] += c;
+        });
+
+    res.reserve(totals.size());
+    for (const auto& kv : totals)
+        res.push_back({tables.zoneNames[kv.first], kv.second});
+
+    rankZones(res, k);
+    return res;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlots(const string& fromDate, const string& toDate, int k) const {
+    vector<SlotCount> res;
+    map<int, DayPartition>::const_iterator first, last;
+    if (!dayRange(fromDate, toDate, first, last)) return res;
+
+    unordered_map<uint64_t, long long> merged;
+    for (auto it = first; it != last; ++it)
+        it->second.slots.forEach([&](uint64_t key, long long c) { merged[key] += c; });
+
+    res.reserve(merged.size());
+    for (const auto& kv : merged)
+        res.push_back({tables.zoneNames[DayPartition::zoneOf(kv.first)],
+                       DayPartition::hourOf(kv.first), kv.second});
+
+    rankSlots(res, k);
+    return res;
+}
+
+// ---------------- hour windows ----------------
+unsigned hourWindow(int fromHour, int toHour) {
+    if (fromHour < 0 || fromHour > 23 || toHour < 0 || toHour > 23) return 0;
+
+    unsigned mask = 0;
+    for (int h = fromHour; ; h = (h + 1) % 24) {
+        mask |= 1u << h;
+        if (h == toHour) break;
+    }
+    return mask;
+}
+
+// All-ones / all-zeros lane per hour, so a masked row sum is a plain
+// AND + add over 24 contiguous counters that the compiler vectorizes.
+static array<long long, 24> laneMask(unsigned hourMask) {
+    array<long long, 24> keep;
+    for (int h = 0; h < 24; ++h) keep[h] = (hourMask >> h & 1) ? -1LL : 0;
+    return keep;
+}
+
+static inline long long maskedSum(const array<long long, 24>& row, const array<long long, 24>& keep) {
+    long long sum = 0;
+    for (int h = 0; h < 24; ++h) sum += row[h] & keep[h];
+    return sum;
+}
+
+vector<ZoneCount> TripAnalyzer::topZonesInHours(unsigned hourMask, int k) const {
+    const auto keep = laneMask(hourMask);
+    auto top = makeTopK<ZoneHit>(k, betterZone);
+
+    const auto& sc = tables.slotCounts;
+    for (size_t id = 0; id < sc.size(); ++id) {
+        long long sum = maskedSum(sc[id], keep);
+        if (sum > 0) top.offer({sum, (int)id});
+    }
+
     vector<ZoneCount> res;
-    for (const auto& kv : zoneCounts)
-        res.push_back({kv.first, kv.second});
+    for (const ZoneHit& z : top.take())
+        res.push_back({tables.zoneNames[z.id], z.count});
+    return res;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlotsInHours(unsigned hourMask, int k) const {
+    auto top = makeTopK<SlotHit>(k, betterSlot);
+
+    const auto& sc = tables.slotCounts;
+    for (size_t id = 0; id < sc.size(); ++id)
+        for (int h = 0; h < 24; ++h)
+            if ((hourMask >> h & 1) && sc[id][h] > 0)
+                top.offer({sc[id][h], (int)id, h});
+
+    vector<SlotCount> res;
+    for (const SlotHit& s : top.take())
+        res.push_back({tables.zoneNames[s.id], s.hour, s.count});
+    return res;
+}
+
+// ---------------- per-hour leaderboards ----------------
+// Offers every zone's count at hours [h0, h1) to that hour's heap; one pass
+// over the slot table fills every leaderboard in the range.
+static void hourBoards(vector<TopK<ZoneHit, bool (*)(const ZoneHit&, const ZoneHit&)>>& tops,
+                       int h0, int h1) {
+    const auto& sc = tables.slotCounts;
+    for (size_t id = 0; id < sc.size(); ++id)
+        for (int h = h0; h < h1; ++h)
+            if (sc[id][h] > 0) tops[h].offer({sc[id][h], (int)id});
+}
+
+vector<vector<ZoneCount>> TripAnalyzer::topZonesByHour(int k, bool parallel) const {
+    vector<TopK<ZoneHit, bool (*)(const ZoneHit&, const ZoneHit&)>> tops;
+    for (int h = 0; h < 24; ++h) tops.push_back(makeTopK<ZoneHit>(k, &betterZone));
+
+    unsigned workers = parallel ? min(24u, max(1u, thread::hardware_concurrency())) : 1;
+    if (workers <= 1) {
+        hourBoards(tops, 0, 24);
+    } else {
+        // each worker owns a contiguous block of hours, so no heap is shared
+        vector<thread> pool;
+        for (unsigned w = 0; w < workers; ++w) {
+            int h0 = (int)(24 * w / workers), h1 = (int)(24 * (w + 1) / workers);
+            pool.emplace_back(hourBoards, ref(tops), h0, h1);
+        }
+        for (auto& t : pool) t.join();
+    }
+
+    vector<vector<ZoneCount>> res(24);
+    for (int h = 0; h < 24; ++h)
+        for (const ZoneHit& z : tops[h].take())
+            res[h].push_back({tables.zoneNames[z.id], z.count});
+    return res;
+}
+
+// ---------------- batch queries ----------------
+// Specs asking for the same (kind, hour mask) share one heap sized for the
+// largest k among them; every heap is fed from a single pass over the slot
+// table and each spec gets a prefix of its group's result.
+vector<QueryResult> TripAnalyzer::runQueries(const vector<QuerySpec>& specs) const {
+    using ZoneTop = TopK<ZoneHit, bool (*)(const ZoneHit&, const ZoneHit&)>;
+    using SlotTop = TopK<SlotHit, bool (*)(const SlotHit&, const SlotHit&)>;
+
+    struct Group {
+        QueryKind kind;
+        unsigned mask;
+        int k;
+    };
+    vector<Group> groups;
+    vector<size_t> groupOf(specs.size());
+    for (size_t i = 0; i < specs.size(); ++i) {
+        const QuerySpec& q = specs[i];
+        unsigned mask = q.hourMask & 0xFFFFFFu;
+        size_t g = 0;
+        while (g < groups.size() && !(groups[g].kind == q.kind && groups[g].mask == mask)) ++g;
+        if (g == groups.size()) groups.push_back({q.kind, mask, 0});
+        groups[g].k = max(groups[g].k, q.k);
+        groupOf[i] = g;
+    }
+
+    vector<ZoneTop> zoneTops;
+    vector<SlotTop> slotTops;
+    vector<array<long long, 24>> keeps;
+    vector<size_t> slot(groups.size());      // group -> index into zoneTops / slotTops
+    for (size_t g = 0; g < groups.size(); ++g) {
+        if (groups[g].kind == QueryKind::Zones) {
+            slot[g] = zoneTops.size();
+            zoneTops.push_back(makeTopK<ZoneHit>(groups[g].k, &betterZone));
+            keeps.push_back(laneMask(groups[g].mask));
+        } else {
+            slot[g] = slotTops.size();
+            slotTops.push_back(makeTopK<SlotHit>(groups[g].k, &betterSlot));
+        }
+    }
+    vector<unsigned> slotMasks;
+    for (const Group& g : groups)
+        if (g.kind == QueryKind::Slots) slotMasks.push_back(g.mask);
+
+    const auto& sc = tables.slotCounts;
+    for (size_t id = 0; id < sc.size(); ++id) {
+        const auto& row = sc[id];
+        for (size_t z = 0; z < zoneTops.size(); ++z) {
+            long long sum = maskedSum(row, keeps[z]);
+            if (sum > 0) zoneTops[z].offer({sum, (int)id});
+        }
+        if (slotTops.empty()) continue;
+        for (int h = 0; h < 24; ++h) {
+            if (row[h] == 0) continue;
+            for (size_t j = 0; j < slotTops.size(); ++j)
+                if (slotMasks[j] >> h & 1) slotTops[j].offer({row[h], (int)id, h});
+        }
+    }
+
+    vector<vector<ZoneHit>> zoneHits;
+    for (auto& t : zoneTops) zoneHits.push_back(t.take());
+    vector<vector<SlotHit>> slotHits;
+    for (auto& t : slotTops) slotHits.push_back(t.take());
+
+    vector<QueryResult> res(specs.size());
+    for (size_t i = 0; i < specs.size(); ++i) {
+        const size_t g = groupOf[i];
+        const size_t k = (size_t)max(specs[i].k, 0);
+        if (groups[g].kind == QueryKind::Zones) {
+            const auto& hits = zoneHits[slot[g]];
+            for (size_t j = 0; j < min(k, hits.size()); ++j)
+                res[i].zones.push_back({tables.zoneNames[hits[j].id], hits[j].count});
+        } else {
+            const auto& hits = slotHits[slot[g]];
+            for (size_t j = 0; j < min(k, hits.size()); ++j)
+                res[i].slots.push_back({tables.zoneNames[hits[j].id], hits[j].hour, hits[j].count});
+        }
+    }
+    return res;
+}
 
+// ---------------- fare / distance ----------------
+static void rankZoneMetrics(vector<ZoneMetric>& res, int k) {
     sort(res.begin(), res.end(),
-         [](const ZoneCount& a, const ZoneCount& b) {
-             if (a.count != b.count) return a.count > b.count;
+         [](const ZoneMetric& a, const ZoneMetric& b) {
+             if (a.value != b.value) return a.value > b.value;
              return a.zone < b.zone;
          });
 
-    if ((int)res.size() > k) res.resize(k);
+    if ((int)res.size() > k) res.resize(max(k, 0));
+}
+
+static vector<ZoneMetric> zoneMetric(const vector<double>& values, int k) {
+    vector<ZoneMetric> res;
+    for (size_t id = 0; id < values.size(); ++id)
+        if (tables.zoneCounts[id] > 0)
+            res.push_back({tables.zoneNames[id], values[id]});
+
+    rankZoneMetrics(res, k);
     return res;
 }
 
-vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    vector<SlotCount> res;
+vector<ZoneMetric> TripAnalyzer::topRevenueZones(int k) const {
+    return zoneMetric(tables.metrics.revenue, k);
+}
 
-    for (const auto& kv : slotCounts) {
+vector<ZoneMetric> TripAnalyzer::topDistanceZones(int k) const {
+    return zoneMetric(tables.metrics.distance, k);
+}
+
+vector<SlotMetric> TripAnalyzer::topAverageFareSlots(int k) const {
+    const Metrics& m = tables.metrics;
+    vector<SlotMetric> res;
+    for (size_t id = 0; id < m.fareSum.size(); ++id)
         for (int h = 0; h < 24; ++h)
-            if (kv.second[h] > 0)
-                res.push_back({kv.first, h, kv.second[h]});
-    }
+            if (m.fareTrips[id][h] > 0)
+                res.push_back({tables.zoneNames[id], h, m.fareSum[id][h] / m.fareTrips[id][h]});
 
     sort(res.begin(), res.end(),
-         [](const SlotCount& a, const SlotCount& b) {
-             if (a.count != b.count) return a.count > b.count;
+         [](const SlotMetric& a, const SlotMetric& b) {
+             if (a.value != b.value) return a.value > b.value;
              if (a.zone != b.zone) return a.zone < b.zone;
              return a.hour < b.hour;
          });
 
-    if ((int)res.size() > k) res.resize(k);
+    if ((int)res.size() > k) res.resize(max(k, 0));
+    return res;
+}
+
+MetricErrors TripAnalyzer::metricErrors() const {
+    return {tables.metrics.badDistance, tables.metrics.badFare};
+}
+
+// ---------------- quantiles ----------------
+static Quantiles summarize(const QuantileSketch& sk) {
+    return {sk.quantile(0.50), sk.quantile(0.95), sk.quantile(0.99), sk.count()};
+}
+
+// Merges the sketches of every listed zone; unknown zones are ignored.
+static Quantiles zoneQuantiles(const vector<string>& zones, QuantileSketch TripSketches::*which) {
+    QuantileSketch merged;
+    for (const string& z : zones) {
+        int id = zoneId(z);
+        if (id >= 0 && (size_t)id < tables.sketches.zones.size())
+            merged.merge(tables.sketches.zones[id].*which);
+    }
+    return summarize(merged);
+}
+
+Quantiles TripAnalyzer::fareQuantiles(const vector<string>& zones) const {
+    return zoneQuantiles(zones, &TripSketches::fare);
+}
+
+Quantiles TripAnalyzer::distanceQuantiles(const vector<string>& zones) const {
+    return zoneQuantiles(zones, &TripSketches::distance);
+}
+
+Quantiles TripAnalyzer::fareQuantilesAtHour(int hour) const {
+    if (hour < 0 || hour > 23) return {0, 0, 0, 0};
+    return summarize(tables.sketches.hours[hour].fare);
+}
+
+Quantiles TripAnalyzer::distanceQuantilesAtHour(int hour) const {
+    if (hour < 0 || hour > 23) return {0, 0, 0, 0};
+    return summarize(tables.sketches.hours[hour].distance);
+}
+
+vector<ZoneMetric> TripAnalyzer::topFareP95Zones(int k) const {
+    vector<ZoneMetric> res;
+    const auto& zs = tables.sketches.zones;
+    for (size_t id = 0; id < zs.size(); ++id)
+        if (zs[id].fare.count() > 0)
+            res.push_back({tables.zoneNames[id], zs[id].fare.quantile(0.95)});
+
+    rankZoneMetrics(res, k);
+    return res;
+}
+
+// ---------------- routes ----------------
+// Ranks packed keys first and only materializes strings for the k survivors.
+vector<RouteCount> TripAnalyzer::topRoutes(int k) const {
+    vector<RouteCount> res;
+    if (k <= 0) return res;
+
+    const CountTable& rt = tables.routes;
+    vector<size_t> slots;
+    slots.reserve(rt.used);
+    for (size_t i = 0; i < rt.keys.size(); ++i)
+        if (rt.keys[i] != CountTable::EMPTY) slots.push_back(i);
+
+    const auto& names = tables.zoneNames;
+    auto better = [&](size_t a, size_t b) {
+        if (rt.counts[a] != rt.counts[b]) return rt.counts[a] > rt.counts[b];
+        const string& pa = names[rt.keys[a] >> 32];
+        const string& pb = names[rt.keys[b] >> 32];
+        if (pa != pb) return pa < pb;
+        return names[(uint32_t)rt.keys[a]] < names[(uint32_t)rt.keys[b]];
+    };
+
+    size_t n = min(slots.size(), (size_t)k);
+    partial_sort(slots.begin(), slots.begin() + n, slots.end(), better);
+
+    res.reserve(n);
+    for (size_t j = 0; j < n; ++j) {
+        size_t i = slots[j];
+        res.push_back({names[rt.keys[i] >> 32], names[(uint32_t)rt.keys[i]], rt.counts[i]});
+    }
     return res;
 }
 
+// ---------------- weekday x hour ----------------
+// Folded out of the day partitions on demand, so ingestion pays nothing
+// beyond the one weekday computed per new partition.
+array<array<long long, 24>, 7> TripAnalyzer::weekdayHeatmap(const string& zone) const {
+    array<array<long long, 24>, 7> heat{};
+
+    int id = zoneId(zone);
+    if (id < 0) return heat;
+
+    for (const auto& day : tables.days) {
+        auto& row = heat[day.second.weekday];
+        for (int h = 0; h < 24; ++h) row[h] += day.second.slots.get(DayPartition::key(id, h));
+    }
+    return heat;
+}
+
+// slot = weekday * 24 + hour, so comparing it orders by weekday, then hour
+struct WeekSlotHit {
+    long long count;
+    int id;
+    int slot;
+};
+
+static bool betterWeekSlot(const WeekSlotHit& a, const WeekSlotHit& b) {
+    if (a.count != b.count) return a.count > b.count;
+    if (a.id != b.id) return tables.zoneNames[a.id] < tables.zoneNames[b.id];
+    return a.slot < b.slot;
+}
+
+vector<WeekSlotCount> TripAnalyzer::topWeekdaySlots(int k) const {
+    vector<WeekSlotCount> res;
+    if (k <= 0) return res;
 
+    unordered_map<int, array<long long, 7 * 24>> heat;
+    for (const auto& day : tables.days) {
+        const int base = day.second.weekday * 24;
+        day.second.slots.forEach([&](uint64_t key, long long c) {
+            heat[DayPartition::zoneOf(key)][base + DayPartition::hourOf(key)] += c;
+        });
+    }
+
+    auto top = makeTopK<WeekSlotHit>(k, betterWeekSlot);
+    for (const auto& kv : heat)
+        for (int s = 0; s < 7 * 24; ++s)
+            if (kv.second[s] > 0)
+                top.offer({kv.second[s], kv.first, s});
 
+    for (const WeekSlotHit& w : top.take())
+        res.push_back({tables.zoneNames[w.id], w.slot / 24, w.slot % 24, w.count});
+    return res;
+}
@@ -1,5 +1,7 @@
 
+#include <array>
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct ZoneCount {
@@ -13,6 +15,100 @@ struct SlotCount {
     long long count;
 };
 
+// Allocation-free variants of ZoneCount / SlotCount. `zone` points into the
+// analyzer's zone dictionary and stays valid until the next ingest or reset.
+struct ZoneCountRef {
+    unsigned id;
+    std::string_view zone;
+    long long count;
+};
+
+struct SlotCountRef {
+    unsigned id;
+    std::string_view zone;
+    int hour;              // 0–23
+    long long count;
+};
+
+struct WeekSlotCount {
+    std::string zone;
+    int weekday;           // 0 = Sunday … 6 = Saturday
+    int hour;              // 0–23
+    long long count;
+};
+
+struct RouteCount {
+    std::string pickup;
+    std::string dropoff;
+    long long count;
+};
+
+struct ZoneMetric {
+    std::string zone;
+    double value;
+};
+
+struct SlotMetric {
+    std::string zone;
+    int hour;              // 0–23
+    double value;
+};
+
+// Rows whose DistanceKm / FareAmount were missing or not a non-negative number
+struct MetricErrors {
+    long long badDistance;
+    long long badFare;
+};
+
+// Approximate quantiles (1% relative error); samples == 0 means no data
+struct Quantiles {
+    double p50;
+    double p95;
+    double p99;
+    long long samples;
+};
+
+// Pickup time encodings
+enum class TimeFormat {
+    Auto,                  // decided by the first row whose time parses
+    DateTime,              // YYYY-MM-DD HH:MM ('T' and :SS allowed)
+    Iso8601,               // DateTime plus .fraction and Z / +HH:MM designators
+    EpochSeconds           // Unix seconds
+};
+
+// Optional work done during ingestion; everything is off by default
+struct IngestOptions {
+    bool metrics = false;       // fare / distance totals
+    bool quantiles = false;     // fare / distance sketches
+    bool liveRanking = false;   // zone ranking maintained row by row
+    bool routes = false;        // pickup->dropoff pair counts
+    bool dayPartitions = false; // per-day (zone, hour) counts for the date / weekday queries
+    TimeFormat timeFormat = TimeFormat::Auto;
+    int utcOffsetMinutes = 0;   // local time = UTC + offset, for epoch / zoned ISO times
+    bool hugePages = false;     // 2 MiB pages for the large tables and the read buffer
+};
+
+// Hour selection for the *InHours queries: bit h set means hour h is included.
+// hourWindow(7, 10) covers 07–10; hourWindow(22, 4) wraps over midnight.
+unsigned hourWindow(int fromHour, int toHour);
+
+enum class QueryKind {
+    Zones,                 // topZonesInHours
+    Slots                  // topBusySlotsInHours
+};
+
+struct QuerySpec {
+    QueryKind kind;
+    int k;
+    unsigned hourMask = 0xFFFFFF;   // all hours
+};
+
+// Only the vector matching the spec's kind is filled
+struct QueryResult {
+    std::vector<ZoneCount> zones;
+    std::vector<SlotCount> slots;
+};
+
 class TripAnalyzer {
 public:
     // Parse Trips.csv, skip dirty rows, never crash
@@ -20,11 +116,114 @@ public:
 
     void ingestStdin();
 
+    // Live feeds: add one data row (no header) to what is already ingested
+    void ingestRow(const std::string& csvRow);
+
+    // Drop everything ingested so far
+    void reset();
+
+    // Back the counter tables and the read buffer with huge pages (hugetlb if
+    // reserved, else transparent huge pages) from the next ingest on; off by default.
+    void enableHugePages(bool on = true);
+
+    // Pickup time format and the fixed UTC offset that turns epoch or zoned
+    // ISO times into local hours/days; DateTime values are taken as local.
+    void setTimeFormat(TimeFormat format, int utcOffsetMinutes = 0);
+
+    // Keep the zone ranking ordered while rows arrive, so topZones(k) is O(k)
+    // at any point of a live feed instead of re-ranking every zone.
+    void enableLiveRanking(bool on = true);
+
     // Top K zones: count desc, zone asc
     std::vector<ZoneCount> topZones(int k = 10) const;
 
     // Top K slots: count desc, zone asc, hour asc
     std::vector<SlotCount> topBusySlots(int k = 10) const;
+
+    // Paging over the full topZones / topBusySlots order: rows [offset, offset + pageSize).
+    // Pages are stable while rankingGeneration() is unchanged; any ingest changes it.
+    std::vector<ZoneCount> zonesPage(size_t offset, size_t pageSize) const;
+    std::vector<SlotCount> slotsPage(size_t offset, size_t pageSize) const;
+    size_t zoneRankingSize() const;
+    size_t slotRankingSize() const;
+    unsigned long long rankingGeneration() const;
+
+    // topZones / topBusySlots without copying zone names (same order)
+    std::vector<ZoneCountRef> topZoneRefs(int k = 10) const;
+    std::vector<SlotCountRef> topSlotRefs(int k = 10) const;
+
+    // Name of an interned zone id; empty for unknown ids
+    std::string_view zoneName(unsigned id) const;
+
+    // Point lookups; unknown zones / hours give 0
+    long long countOf(const std::string& zone) const;
+    long long countOf(const std::string& zone, int hour) const;
+
+    // 1-based position in topZones order, 0 if the zone has no pickups
+    int rankOf(const std::string& zone) const;
+
+    // Per-day partitions behind the date-range and weekday queries are off by
+    // default; turn them on before ingesting. Those queries only see rows
+    // ingested while on.
+    void enableDayPartitions(bool on = true);
+
+    // Same rankings restricted to trips dated in [fromDate, toDate],
+    // both "YYYY-MM-DD" and inclusive. Invalid ranges return nothing.
+    std::vector<ZoneCount> topZones(const std::string& fromDate, const std::string& toDate, int k = 10) const;
+    std::vector<SlotCount> topBusySlots(const std::string& fromDate, const std::string& toDate, int k = 10) const;
+
+    // Same orderings counting only the hours in hourMask (see hourWindow)
+    std::vector<ZoneCount> topZonesInHours(unsigned hourMask, int k = 10) const;
+    std::vector<SlotCount> topBusySlotsInHours(unsigned hourMask, int k = 10) const;
+
+    // Top K zones for each hour (index 0–23), from one scan of the slot table.
+    // parallel splits the 24 selections across threads.
+    std::vector<std::vector<ZoneCount>> topZonesByHour(int k = 10, bool parallel = false) const;
+
+    // Answers many zone/slot queries with one scan of the slot table.
+    // Results come back in the order of specs.
+    std::vector<QueryResult> runQueries(const std::vector<QuerySpec>& specs) const;
+
+    // Top K pickup->dropoff pairs: count desc, pickup asc, dropoff asc
+    std::vector<RouteCount> topRoutes(int k = 10) const;
+
+    // Route counting is off by default, and the dropoff column is then never
+    // read; turn it on before ingesting. topRoutes only sees rows ingested while on.
+    void enableRoutes(bool on = true);
+
+    // Fare/distance aggregation is off by default; turn it on before ingesting.
+    void enableTripMetrics(bool on = true);
+
+    // Ranked by value desc, zone asc (slots: then hour asc). Empty unless metrics were on.
+    std::vector<ZoneMetric> topRevenueZones(int k = 10) const;
+    std::vector<ZoneMetric> topDistanceZones(int k = 10) const;
+    std::vector<SlotMetric> topAverageFareSlots(int k = 10) const;
+    MetricErrors metricErrors() const;
+
+    // Per-zone and per-hour fare/distance sketches; off by default, enable before ingesting.
+    void enableQuantiles(bool on = true);
+
+    // Quantiles over the union of the given zones (one zone for a per-zone answer)
+    Quantiles fareQuantiles(const std::vector<std::string>& zones) const;
+    Quantiles distanceQuantiles(const std::vector<std::string>& zones) const;
+
+    // Quantiles over all zones for one pickup hour
+    Quantiles fareQuantilesAtHour(int hour) const;
+    Quantiles distanceQuantilesAtHour(int hour) const;
+
+    // Most expensive zones: p95 fare desc, zone asc
+    std::vector<ZoneMetric> topFareP95Zones(int k = 10) const;
+
+    // Trips per [weekday][hour] for one zone (dated rows only).
+    // Needs enableDayPartitions() before ingest; all zeros otherwise.
+    std::array<std::array<long long, 24>, 7> weekdayHeatmap(const std::string& zone) const;
+
+    // Top K (zone, weekday, hour): count desc, zone asc, weekday asc, hour asc.
+    // Needs enableDayPartitions() before ingest; empty otherwise.
+    std::vector<WeekSlotCount> topWeekdaySlots(int k = 10) const;
+
+private:
+    IngestOptions options;
 };
 
 
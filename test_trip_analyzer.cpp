@@ -281,3 +281,1148 @@ TEST_CASE("C3", "[C3]") {
 
     std::remove(path.c_str());
 }
+
+// ------------------- D: extended queries -------------------
+
+TEST_CASE("D1", "[D1]") {
+    const std::string path = "d1.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 10:00,1,1",
+        "2,ZONE_A,ZX,2024-01-02 10:00,1,1",
+        "3,ZONE_B,ZX,2024-01-02 11:00,1,1",
+        "4,ZONE_B,ZX,2024-01-02 11:30,1,1",
+        "5,ZONE_C,ZX,2024-01-03 09:00,1,1",
+        "6,ZONE_C,ZX,2024-02-29 09:00,1,1"
+    });
+
+    // partitions are opt-in
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topZones(10).size() == 3);
+    REQUIRE(plain.topZones("2024-01-01", "2024-12-31", 10).empty());
+
+    TripAnalyzer ta;
+    ta.enableDayPartitions();
+    ta.ingestFile(path);
+
+    // whole range == unfiltered ranking
+    auto all = ta.topZones("2024-01-01", "2024-12-31", 10);
+    REQUIRE(all.size() == 3);
+    REQUIRE(all[0].zone == "ZONE_A");
+    REQUIRE(all[0].count == 2);
+
+    auto day2 = ta.topZones("2024-01-02", "2024-01-02", 10);
+    REQUIRE(day2.size() == 2);
+    REQUIRE(day2[0].zone == "ZONE_B");
+    REQUIRE(day2[0].count == 2);
+    REQUIRE(hasZone(day2, "ZONE_A", 1));
+
+    auto slots = ta.topBusySlots("2024-01-02", "2024-01-03", 10);
+    REQUIRE(slots.size() == 3);
+    REQUIRE(hasSlot(slots, "ZONE_B", 11, 2));
+    REQUIRE(hasSlot(slots, "ZONE_C", 9, 1));
+
+    REQUIRE(ta.topZones("2024-02-29", "2024-02-29", 10).size() == 1);
+    REQUIRE(ta.topZones("2024-03-01", "2024-01-01", 10).empty());
+    REQUIRE(ta.topZones("garbage", "2024-01-01", 10).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D2", "[D2]") {
+    const std::string path = "d2.csv";
+
+    // 2024-01-01 is a Monday, 2024-01-08 the Monday after, 1969-12-28 a Sunday
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 08:00,1,1",
+        "2,ZONE_A,ZX,2024-01-08 08:15,1,1",
+        "3,ZONE_A,ZX,2024-01-06 08:00,1,1",
+        "4,ZONE_B,ZX,2024-01-02 17:00,1,1",
+        "5,ZONE_B,ZX,1969-12-28 17:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.enableDayPartitions();
+    ta.ingestFile(path);
+
+    auto heat = ta.weekdayHeatmap("ZONE_A");
+    REQUIRE(heat[1][8] == 2);
+    REQUIRE(heat[6][8] == 1);
+    REQUIRE(ta.weekdayHeatmap("ZONE_B")[0][17] == 1);
+    REQUIRE(ta.weekdayHeatmap("ZONE_B")[2][17] == 1);
+    REQUIRE(ta.weekdayHeatmap("NOPE")[1][8] == 0);
+
+    auto top = ta.topWeekdaySlots(3);
+    REQUIRE(top.size() == 3);
+    REQUIRE(top[0].zone == "ZONE_A");
+    REQUIRE(top[0].weekday == 1);
+    REQUIRE(top[0].hour == 8);
+    REQUIRE(top[0].count == 2);
+    REQUIRE(top[1].zone == "ZONE_A");
+    REQUIRE(top[1].weekday == 6);
+    REQUIRE(top[2].zone == "ZONE_B");
+    REQUIRE(top[2].weekday == 0);
+
+    // the top-k selection is a prefix of the full order
+    auto all = ta.topWeekdaySlots(100);
+    REQUIRE(all.size() == 4);
+    for (size_t i = 0; i < top.size(); ++i) {
+        REQUIRE(all[i].zone == top[i].zone);
+        REQUIRE(all[i].weekday == top[i].weekday);
+        REQUIRE(all[i].hour == top[i].hour);
+    }
+    REQUIRE(all[3].zone == "ZONE_B");
+    REQUIRE(all[3].weekday == 2);
+    REQUIRE(ta.topWeekdaySlots(0).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D3", "[D3]") {
+    const std::string path = "d3.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_B,ZONE_A,2024-01-01 08:00,1,1",
+        "2,ZONE_A,ZONE_C,2024-01-01 08:00,1,1",
+        "3,ZONE_A,ZONE_B,2024-01-01 09:00,1,1",
+        "4,ZONE_A,ZONE_C,2024-01-01 10:00,1,1",
+        "5,ZONE_A,ZONE_B,2024-01-01 11:00,1,1",
+        "6,ZONE_B,,2024-01-01 11:00,1,1",
+        "7,ZONE_A,ZONE_D,bad,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.enableRoutes();
+    ta.ingestFile(path);
+
+    auto routes = ta.topRoutes(10);
+    REQUIRE(routes.size() == 3);
+    REQUIRE(routes[0].pickup == "ZONE_A");
+    REQUIRE(routes[0].dropoff == "ZONE_B");
+    REQUIRE(routes[0].count == 2);
+    REQUIRE(routes[1].dropoff == "ZONE_C");
+    REQUIRE(routes[1].count == 2);
+    REQUIRE(routes[2].pickup == "ZONE_B");
+    REQUIRE(routes[2].dropoff == "ZONE_A");
+
+    // dropoff-only zones never show up as pickups
+    auto topZ = ta.topZones(10);
+    REQUIRE(topZ.size() == 2);
+    REQUIRE_FALSE(hasZone(topZ, "ZONE_C", 0));
+
+    REQUIRE(ta.topRoutes(1).size() == 1);
+    REQUIRE(ta.topRoutes(0).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D4", "[D4]") {
+    const std::string path = "d4.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 08:00,2.5,10.0",
+        "2,ZONE_A,ZX,2024-01-01 08:30,1.5,20.0",
+        "3,ZONE_B,ZX,2024-01-01 09:00,10.0,25.0",
+        "4,ZONE_B,ZX,2024-01-01 09:00,abc,7.0",
+        "5,ZONE_C,ZX,2024-01-01 10:00,1.0,-3",
+        "6,ZONE_C,ZX,2024-01-01 10:00,1.0,"
+    });
+
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topRevenueZones(10).empty());
+
+    TripAnalyzer ta;
+    ta.enableTripMetrics();
+    ta.ingestFile(path);
+
+    // counts are unaffected by bad numeric columns
+    REQUIRE(hasZone(ta.topZones(10), "ZONE_C", 2));
+
+    auto rev = ta.topRevenueZones(10);
+    REQUIRE(rev.size() == 3);
+    REQUIRE(rev[0].zone == "ZONE_B");
+    REQUIRE(rev[0].value == Catch::Approx(32.0));
+    REQUIRE(rev[1].zone == "ZONE_A");
+    REQUIRE(rev[2].value == 0.0);
+
+    auto dist = ta.topDistanceZones(1);
+    REQUIRE(dist[0].zone == "ZONE_B");
+    REQUIRE(dist[0].value == Catch::Approx(10.0));
+
+    auto avg = ta.topAverageFareSlots(10);
+    REQUIRE(avg.size() == 2);
+    REQUIRE(avg[0].zone == "ZONE_B");
+    REQUIRE(avg[0].hour == 9);
+    REQUIRE(avg[0].value == Catch::Approx(16.0));
+    REQUIRE(avg[1].zone == "ZONE_A");
+    REQUIRE(avg[1].value == Catch::Approx(15.0));
+
+    auto err = ta.metricErrors();
+    REQUIRE(err.badDistance == 1);
+    REQUIRE(err.badFare == 2);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D5", "[D5]") {
+    const std::string path = "d5.csv";
+
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+
+    // ZONE_A fares 1..100 at hour 7, ZONE_B fares 50..59 at hour 8
+    long long id = 1;
+    for (int i = 1; i <= 100; ++i, ++id)
+        out << id << ",ZONE_A,ZX,2024-01-01 07:00," << i * 0.5 << "," << i << "\n";
+    for (int i = 0; i < 10; ++i, ++id)
+        out << id << ",ZONE_B,ZX,2024-01-01 08:00,2.0," << 50 + i << "\n";
+    out.close();
+
+    TripAnalyzer ta;
+    ta.enableQuantiles();
+    ta.ingestFile(path);
+
+    auto a = ta.fareQuantiles({"ZONE_A"});
+    REQUIRE(a.samples == 100);
+    REQUIRE(a.p50 == Catch::Approx(50.0).epsilon(0.02));
+    REQUIRE(a.p95 == Catch::Approx(95.0).epsilon(0.02));
+    REQUIRE(a.p99 == Catch::Approx(99.0).epsilon(0.02));
+
+    auto d = ta.distanceQuantiles({"ZONE_A"});
+    REQUIRE(d.p50 == Catch::Approx(25.0).epsilon(0.02));
+
+    // merged sketches cover both zones
+    auto both = ta.fareQuantiles({"ZONE_A", "ZONE_B", "NOPE"});
+    REQUIRE(both.samples == 110);
+
+    REQUIRE(ta.fareQuantilesAtHour(8).samples == 10);
+    REQUIRE(ta.fareQuantilesAtHour(9).samples == 0);
+
+    auto top = ta.topFareP95Zones(2);
+    REQUIRE(top.size() == 2);
+    REQUIRE(top[0].zone == "ZONE_A");
+    REQUIRE(top[1].zone == "ZONE_B");
+
+    // one far outlier must not fold the ordinary fares into a single bucket
+    const std::string p2 = "d5b.csv";
+    {
+        std::ofstream o2(p2);
+        o2 << HDR << "\n";
+        for (int i = 0; i < 1000; ++i)
+            o2 << i << ",Z,ZX,2024-01-01 09:00,1.0," << 10 + i * 0.01 << "\n";
+        o2 << "1000,Z,ZX,2024-01-01 09:00,1.0,10000\n";
+    }
+    ta.ingestFile(p2);
+    auto z = ta.fareQuantiles({"Z"});
+    REQUIRE(z.samples == 1001);
+    REQUIRE(z.p50 == Catch::Approx(15.0).epsilon(0.01));
+    REQUIRE(z.p95 == Catch::Approx(19.5).epsilon(0.01));
+    REQUIRE(ta.topFareP95Zones(1)[0].value == Catch::Approx(19.5).epsilon(0.01));
+
+    std::remove(path.c_str());
+    std::remove(p2.c_str());
+}
+
+TEST_CASE("D6", "[D6]") {
+    const std::string p1 = "d6a.csv";
+    const std::string p2 = "d6b.csv";
+
+    writeFile(p1, {
+        HDR,
+        "1,ZONE_B,ZX,2024-01-01 10:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 11:00,1,1",
+        "3,ZONE_B,ZX,2024-01-01 11:00,1,1"
+    });
+    writeFile(p2, {
+        HDR,
+        "1,ZONE_C,ZX,2024-01-01 05:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(p1);
+
+    // repeated queries with different k slice the same ranking
+    auto all = ta.topZones(10);
+    auto one = ta.topZones(1);
+    REQUIRE(all.size() == 2);
+    REQUIRE(one.size() == 1);
+    REQUIRE(one[0].zone == all[0].zone);
+    REQUIRE(ta.topBusySlots(2)[1].zone == "ZONE_B");
+    REQUIRE(ta.topBusySlots(1)[0].hour == 11);
+
+    // a new ingest invalidates the cached order
+    ta.ingestFile(p2);
+    auto fresh = ta.topZones(10);
+    REQUIRE(fresh.size() == 1);
+    REQUIRE(fresh[0].zone == "ZONE_C");
+    REQUIRE(ta.topBusySlots(10).size() == 1);
+
+    std::remove(p1.c_str());
+    std::remove(p2.c_str());
+}
+
+TEST_CASE("D7", "[D7]") {
+    const std::string path = "d7.csv";
+
+    std::vector<std::string> rows = {HDR};
+    for (int i = 0; i < 500; ++i) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1", i, (i * 7) % 37, i % 24);
+        rows.push_back(buf);
+    }
+    writeFile(path, rows);
+
+    TripAnalyzer batch;
+    batch.ingestFile(path);
+    auto expected = batch.topZones(100);
+
+    // same rows fed one by one, querying mid-stream
+    TripAnalyzer live;
+    live.enableLiveRanking();
+    live.reset();
+    for (size_t i = 1; i < rows.size(); ++i) {
+        live.ingestRow(rows[i]);
+        if (i == 3) {
+            auto early = live.topZones(10);
+            REQUIRE(early.size() == 3);
+            REQUIRE(early[0].count == 1);
+            REQUIRE(early[0].zone < early[1].zone);
+        }
+    }
+
+    auto got = live.topZones(100);
+    REQUIRE(got.size() == expected.size());
+    for (size_t i = 0; i < got.size(); ++i) {
+        REQUIRE(got[i].zone == expected[i].zone);
+        REQUIRE(got[i].count == expected[i].count);
+    }
+
+    // a batch ingest with live ranking on gives the same order
+    live.ingestFile(path);
+    REQUIRE(live.topZones(5).size() == 5);
+    REQUIRE(live.topZones(5)[4].zone == expected[4].zone);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D8", "[D8]") {
+    const std::string path = "d8.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 07:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 10:59,1,1",
+        "3,ZONE_B,ZX,2024-01-01 08:00,1,1",
+        "4,ZONE_B,ZX,2024-01-01 08:10,1,1",
+        "5,ZONE_B,ZX,2024-01-01 08:20,1,1",
+        "6,ZONE_C,ZX,2024-01-01 23:00,1,1",
+        "7,ZONE_C,ZX,2024-01-01 02:00,1,1",
+        "8,ZONE_A,ZX,2024-01-01 12:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    REQUIRE(hourWindow(7, 10) == 0x780u);
+    REQUIRE(hourWindow(22, 4) == ((1u << 22) | (1u << 23) | 0x1Fu));
+    REQUIRE(hourWindow(24, 1) == 0u);
+
+    auto rush = ta.topZonesInHours(hourWindow(7, 10), 10);
+    REQUIRE(rush.size() == 2);
+    REQUIRE(rush[0].zone == "ZONE_B");
+    REQUIRE(rush[0].count == 3);
+    REQUIRE(rush[1].zone == "ZONE_A");
+    REQUIRE(rush[1].count == 2);
+
+    auto night = ta.topZonesInHours(hourWindow(22, 4), 10);
+    REQUIRE(night.size() == 1);
+    REQUIRE(hasZone(night, "ZONE_C", 2));
+
+    auto nightSlots = ta.topBusySlotsInHours(hourWindow(22, 4), 10);
+    REQUIRE(nightSlots.size() == 2);
+    REQUIRE(nightSlots[0].hour == 2);
+    REQUIRE(nightSlots[1].hour == 23);
+
+    // full mask matches the unfiltered ranking
+    auto all = ta.topZonesInHours(0xFFFFFFu, 2);
+    auto ref = ta.topZones(2);
+    REQUIRE(all[0].zone == ref[0].zone);
+    REQUIRE(all[1].zone == ref[1].zone);
+    REQUIRE(ta.topZonesInHours(0, 10).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D9", "[D9]") {
+    const std::string path = "d9.csv";
+
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+
+    // zone i gets (i % 5) + 1 trips at hour i % 24
+    long long id = 1;
+    for (int z = 0; z < 240; ++z)
+        for (int n = 0; n <= z % 5; ++n, ++id) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "2024-01-01 %02d:00", z % 24);
+            out << id << ",ZONE_" << z << ",ZX," << buf << ",1,1\n";
+        }
+    out.close();
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    auto boards = ta.topZonesByHour(3);
+    auto pboards = ta.topZonesByHour(3, true);
+    REQUIRE(boards.size() == 24);
+    REQUIRE(pboards.size() == 24);
+
+    for (int h = 0; h < 24; ++h) {
+        auto ref = ta.topZonesInHours(1u << h, 3);
+        REQUIRE(boards[h].size() == ref.size());
+        REQUIRE(pboards[h].size() == ref.size());
+        for (size_t i = 0; i < ref.size(); ++i) {
+            REQUIRE(boards[h][i].zone == ref[i].zone);
+            REQUIRE(boards[h][i].count == ref[i].count);
+            REQUIRE(pboards[h][i].zone == ref[i].zone);
+        }
+    }
+    REQUIRE(boards[0][0].count == 5);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D10", "[D10]") {
+    const std::string path = "d10.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_B,ZONE_D,2024-01-01 10:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 11:00,1,1",
+        "3,ZONE_B,ZX,2024-01-01 11:00,1,1",
+        "4,ZONE_C,ZX,2024-01-01 11:00,1,1",
+        "5,ZONE_B,ZX,2024-01-01 11:30,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    REQUIRE(ta.countOf("ZONE_B") == 3);
+    REQUIRE(ta.countOf("ZONE_B", 11) == 2);
+    REQUIRE(ta.countOf("ZONE_B", 9) == 0);
+    REQUIRE(ta.countOf("ZONE_B", 24) == 0);
+    REQUIRE(ta.countOf("NOPE") == 0);
+
+    REQUIRE(ta.rankOf("ZONE_B") == 1);
+    REQUIRE(ta.rankOf("ZONE_A") == 2);
+    REQUIRE(ta.rankOf("ZONE_C") == 3);
+    REQUIRE(ta.rankOf("ZONE_D") == 0);   // dropoff only
+    REQUIRE(ta.rankOf("NOPE") == 0);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D11", "[D11]") {
+    const std::string path = "d11.csv";
+
+    std::vector<std::string> rows = {HDR};
+    for (int i = 0; i < 300; ++i) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1", i, (i * 13) % 97, i % 24);
+        rows.push_back(buf);
+    }
+    writeFile(path, rows);
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    auto full = ta.topZones(1000);
+    REQUIRE(ta.zoneRankingSize() == full.size());
+
+    auto gen = ta.rankingGeneration();
+    std::vector<ZoneCount> paged;
+    for (size_t off = 0; off < ta.zoneRankingSize(); off += 10) {
+        auto page = ta.zonesPage(off, 10);
+        REQUIRE(page.size() <= 10);
+        paged.insert(paged.end(), page.begin(), page.end());
+    }
+    REQUIRE(ta.rankingGeneration() == gen);
+    REQUIRE(paged.size() == full.size());
+    for (size_t i = 0; i < full.size(); ++i) REQUIRE(paged[i].zone == full[i].zone);
+
+    auto slots = ta.topBusySlots(1000);
+    REQUIRE(ta.slotRankingSize() == slots.size());
+    auto tail = ta.slotsPage(slots.size() - 3, 10);
+    REQUIRE(tail.size() == 3);
+    REQUIRE(tail[2].zone == slots.back().zone);
+    REQUIRE(tail[2].hour == slots.back().hour);
+    REQUIRE(ta.slotsPage(slots.size() + 5, 10).empty());
+
+    ta.ingestFile(path);
+    REQUIRE(ta.rankingGeneration() != gen);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D12", "[D12]") {
+    const std::string path = "d12.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_B,ZX,2024-01-01 10:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 11:00,1,1",
+        "3,ZONE_B,ZX,2024-01-01 11:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    auto refs = ta.topZoneRefs(10);
+    auto zones = ta.topZones(10);
+    REQUIRE(refs.size() == zones.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+        REQUIRE(refs[i].zone == zones[i].zone);
+        REQUIRE(refs[i].count == zones[i].count);
+        REQUIRE(ta.zoneName(refs[i].id) == refs[i].zone);
+    }
+
+    auto srefs = ta.topSlotRefs(2);
+    REQUIRE(srefs.size() == 2);
+    REQUIRE(srefs[0].zone == "ZONE_A");
+    REQUIRE(srefs[0].hour == 11);
+    REQUIRE(srefs[1].zone == "ZONE_B");
+    REQUIRE(srefs[1].hour == 10);
+
+    REQUIRE(ta.zoneName(1000).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D13", "[D13]") {
+    const std::string path = "d13.csv";
+
+    // skewed: most zones tie at count 1, a few heavy ones, all hours used
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    long long id = 1;
+    for (int z = 0; z < 3000; ++z, ++id) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "2024-01-01 %02d:00", (z * 5) % 24);
+        out << id << ",Z" << (z * 7919) % 3000 << ",ZX," << buf << ",1,1\n";
+    }
+    for (int z = 0; z < 300; ++z)
+        for (int n = 0; n < z % 7; ++n, ++id)
+            out << id << ",Z" << z << ",ZX,2024-01-01 0" << n << ":00,1,1\n";
+    out.close();
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    auto zones = ta.topZones(100000);
+    REQUIRE(zones.size() == 3000);
+    for (size_t i = 1; i < zones.size(); ++i) {
+        const auto& a = zones[i - 1];
+        const auto& b = zones[i];
+        REQUIRE((a.count > b.count || (a.count == b.count && a.zone < b.zone)));
+    }
+
+    auto slots = ta.topBusySlots(1000000);
+    long long total = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        total += slots[i].count;
+        if (i == 0) continue;
+        const auto& a = slots[i - 1];
+        const auto& b = slots[i];
+        REQUIRE((a.count > b.count ||
+                 (a.count == b.count && (a.zone < b.zone || (a.zone == b.zone && a.hour < b.hour)))));
+    }
+    REQUIRE(total == id - 1);
+
+    std::remove(path.c_str());
+}
+
+// Test hook defined in analyzer.cpp; not part of the public header.
+extern void setParallelSortForTesting(size_t minKeys, unsigned workers);
+
+TEST_CASE("D14", "[D14]") {
+    const std::string path = "d14.csv";
+    {
+        // a few thousand zones with many tied counts
+        std::ofstream out(path);
+        out << HDR << "\n";
+        for (int i = 0; i < 30000; ++i)
+            out << i << ",P" << (i * 31) % 3001 << ",ZX,2024-03-01 0" << i % 7 << ":00,1,1\n";
+    }
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    const auto zones = ta.topZones(5000);
+    const auto slots = ta.topBusySlots(30000);
+    REQUIRE(zones.size() == 3001);
+
+    // force the chunked sort and merge, including an odd run count
+    for (unsigned workers : {2u, 3u, 8u}) {
+        setParallelSortForTesting(64, workers);
+        ta.ingestFile(path);
+        const auto pz = ta.topZones(5000);
+        const auto ps = ta.topBusySlots(30000);
+        REQUIRE(pz.size() == zones.size());
+        REQUIRE(ps.size() == slots.size());
+        size_t zoneDiffs = 0, slotDiffs = 0;
+        for (size_t i = 0; i < zones.size(); ++i)
+            zoneDiffs += pz[i].zone != zones[i].zone || pz[i].count != zones[i].count;
+        for (size_t i = 0; i < slots.size(); ++i)
+            slotDiffs += ps[i].zone != slots[i].zone || ps[i].hour != slots[i].hour ||
+                         ps[i].count != slots[i].count;
+        REQUIRE(zoneDiffs == 0);
+        REQUIRE(slotDiffs == 0);
+    }
+    setParallelSortForTesting(1 << 20, 0);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D15", "[D15]") {
+    const std::string path = "d15.csv";
+
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    long long id = 1;
+    for (int z = 0; z < 200; ++z)
+        for (int n = 0; n < 1 + z % 9; ++n, ++id) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "2024-01-01 %02d:00", (z + n * 5) % 24);
+            out << id << ",ZONE_" << z << ",ZX," << buf << ",1,1\n";
+        }
+    out.close();
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    const unsigned rush = hourWindow(7, 10);
+    std::vector<QuerySpec> specs = {
+        {QueryKind::Zones, 10},
+        {QueryKind::Slots, 20},
+        {QueryKind::Zones, 5, rush},
+        {QueryKind::Zones, 50},
+        {QueryKind::Slots, 7, hourWindow(22, 4)},
+        {QueryKind::Zones, 0}
+    };
+    auto res = ta.runQueries(specs);
+    REQUIRE(res.size() == specs.size());
+
+    auto sameZones = [](const std::vector<ZoneCount>& a, const std::vector<ZoneCount>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (a[i].zone != b[i].zone || a[i].count != b[i].count) return false;
+        return true;
+    };
+    auto sameSlots = [](const std::vector<SlotCount>& a, const std::vector<SlotCount>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (a[i].zone != b[i].zone || a[i].hour != b[i].hour || a[i].count != b[i].count) return false;
+        return true;
+    };
+
+    REQUIRE(sameZones(res[0].zones, ta.topZones(10)));
+    REQUIRE(sameSlots(res[1].slots, ta.topBusySlots(20)));
+    REQUIRE(sameZones(res[2].zones, ta.topZonesInHours(rush, 5)));
+    REQUIRE(sameZones(res[3].zones, ta.topZones(50)));
+    REQUIRE(sameSlots(res[4].slots, ta.topBusySlotsInHours(hourWindow(22, 4), 7)));
+    REQUIRE(res[5].zones.empty());
+    REQUIRE(res[0].slots.empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D16", "[D16]") {
+    const std::string p1 = "d16a.csv";
+    const std::string p2 = "d16b.csv";
+    const std::string p3 = "d16c.csv";
+
+    // reordered and extra columns
+    writeFile(p1, {
+        "FareAmount,PickupDateTime,Vendor,PickupZoneID,TripID,DropoffZoneID,DistanceKm",
+        "10.0,2024-01-01 09:00,V1,ZONE_A,1,ZONE_B,2.0",
+        "12.0,2024-01-01 09:30,V2,ZONE_A,2,ZONE_B,3.0",
+        "5.0,2024-01-01 23:10,V1,ZONE_C,3,,1.0",
+        "5.0,2024-01-01 23:10,V1",
+        "5.0,bad,V1,ZONE_C,4,ZONE_A,1.0"
+    });
+    // README's 3-column format
+    writeFile(p2, {
+        "TripID,PickupZoneID,PickupTime",
+        "1,Z1,2024-01-01 10:30",
+        "2,Z2,2024-01-01 11:05",
+        "3,Z1,2024-01-01 10:45"
+    });
+    // unrecognized header: per-row layout guess
+    writeFile(p3, {
+        "id,zone,when",
+        "1,Z1,2024-01-01 10:30",
+        "2,Z1,ZX,2024-01-01 11:05,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.enableTripMetrics();
+    ta.enableRoutes();
+    ta.ingestFile(p1);
+
+    REQUIRE(ta.countOf("ZONE_A") == 2);
+    REQUIRE(ta.countOf("ZONE_A", 9) == 2);
+    REQUIRE(ta.countOf("ZONE_C", 23) == 1);
+    REQUIRE(ta.topRoutes(10).size() == 1);
+    REQUIRE(ta.topRoutes(10)[0].count == 2);
+    REQUIRE(ta.topRevenueZones(1)[0].value == Catch::Approx(22.0));
+    REQUIRE(ta.topDistanceZones(1)[0].value == Catch::Approx(5.0));
+
+    ta.ingestFile(p2);
+    REQUIRE(ta.countOf("Z1") == 2);
+    REQUIRE(ta.countOf("Z2", 11) == 1);
+
+    ta.ingestFile(p3);
+    REQUIRE(ta.countOf("Z1") == 2);
+
+    // under the two README headers, rows of the other layout keep the
+    // per-row reading; 4-field rows are rejected under both
+    const std::string p4 = "d16d.csv";
+    const std::string p5 = "d16e.csv";
+    const std::vector<std::string> mixed = {
+        "1,Z1,2024-01-01 10:30",
+        "2,Z1,ZX,2024-01-01 11:05,2.0,4.0",
+        "3,Z1,ZX,2024-01-01 12:00,2.0",
+        "4,Z1,ZX,2024-01-01 13:00"
+    };
+    std::vector<std::string> six = {HDR};
+    std::vector<std::string> three = {"TripID,PickupZoneID,PickupTime"};
+    six.insert(six.end(), mixed.begin(), mixed.end());
+    three.insert(three.end(), mixed.begin(), mixed.end());
+    writeFile(p4, six);
+    writeFile(p5, three);
+
+    for (const std::string& p : {p4, p5}) {
+        ta.ingestFile(p);
+        REQUIRE(ta.countOf("Z1") == 3);
+        REQUIRE(ta.countOf("Z1", 10) == 1);
+        REQUIRE(ta.countOf("Z1", 11) == 1);
+        REQUIRE(ta.countOf("Z1", 12) == 1);
+        REQUIRE(ta.topRoutes(10).size() == 1);
+        REQUIRE(ta.topRoutes(10)[0].count == 2);
+        REQUIRE(ta.topDistanceZones(1)[0].value == Catch::Approx(4.0));
+        REQUIRE(ta.topRevenueZones(1)[0].value == Catch::Approx(4.0));
+    }
+
+    std::remove(p1.c_str());
+    std::remove(p2.c_str());
+    std::remove(p3.c_str());
+    std::remove(p4.c_str());
+    std::remove(p5.c_str());
+}
+
+TEST_CASE("D17", "[D17]") {
+    const std::string p1 = "d17a.csv";
+    const std::string p2 = "d17b.csv";
+
+    // quoted fields: embedded delimiter, escaped quotes, embedded newline
+    writeFile(p1, {
+        "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount",
+        "1,\"ZONE 12, North\",ZONE_B,2024-01-01 09:00,2.0,10.0",
+        "2,\"ZONE 12, North\",\"ZONE_B\",\"2024-01-01 09:30\",\"1.5\",8.0",
+        "3,\"say \"\"hi\"\"\",ZONE_B,2024-01-01 10:00,1.0,5.0",
+        "4,\"two\nlines\",ZONE_B,2024-01-01 11:00,1.0,5.0",
+        "5,ZONE_B,\"x,y\",2024-01-01 12:00,1.0,5.0",
+        "6,\"\",ZONE_B,2024-01-01 12:00,1.0,5.0"
+    });
+    // same rows under an unrecognized header
+    writeFile(p2, {
+        "a,b,c",
+        "1,\"ZONE 12, North\",2024-01-01 09:00",
+        "2,\"ZONE 12, North\",ZONE_B,2024-01-01 09:30,1.0,1.0"
+    });
+
+    TripAnalyzer ta;
+    ta.enableTripMetrics();
+    ta.ingestFile(p1);
+
+    REQUIRE(ta.countOf("ZONE 12, North") == 2);
+    REQUIRE(ta.countOf("ZONE 12, North", 9) == 2);
+    REQUIRE(ta.countOf("say \"hi\"", 10) == 1);
+    REQUIRE(ta.countOf("two\nlines", 11) == 1);
+    REQUIRE(ta.countOf("ZONE_B", 12) == 1);
+    REQUIRE(ta.zoneRankingSize() == 4);
+    REQUIRE(ta.topDistanceZones(1)[0].zone == "ZONE 12, North");
+    REQUIRE(ta.topDistanceZones(1)[0].value == Catch::Approx(3.5));
+
+    ta.ingestRow("7,\"ZONE 12, North\",ZONE_B,2024-01-01 09:45,1.0,1.0");
+    REQUIRE(ta.countOf("ZONE 12, North", 9) == 3);
+
+    ta.ingestFile(p2);
+    REQUIRE(ta.countOf("ZONE 12, North") == 2);
+
+    // a stray quote never closes: only its own line is lost, in any buffer
+    const std::string p3 = "d17c.csv";
+    const int rows = 100000;
+    {
+        std::ofstream out(p3);
+        out << HDR << "\n";
+        out << "0,\"A,B,2024-01-01 10:00,1,1\n";
+        for (int i = 1; i <= rows; ++i) {
+            if (i == rows / 2) out << i << ",\"Z1,ZX,2024-01-01 10:00,1,1\n";
+            out << i << ",Z" << i % 3 << ",ZX,2024-01-01 10:00,1,1\n";
+        }
+        out << "x,\"Z1,ZX,2024-01-01 10:00,1,1";
+    }
+    ta.ingestFile(p3);
+    long long total = 0;
+    for (const auto& z : ta.topZones(10)) total += z.count;
+    REQUIRE(total == rows);
+    REQUIRE(ta.zoneRankingSize() == 3);
+
+    std::remove(p1.c_str());
+    std::remove(p2.c_str());
+    std::remove(p3.c_str());
+}
+
+TEST_CASE("D18", "[D18]") {
+    const std::string path = "d18.csv";
+    // columns past the last needed one are never read, even when dirty
+    writeFile(path, {
+        "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount,A,B,C",
+        "1,ZONE_A,ZONE_B,2024-01-01 09:00,2.0,10.0,x,y,z",
+        "2,ZONE_A,ZONE_B,2024-01-01 09:30,1.0,5.0,x\"y,,,,,",
+        "3,ZONE_B,ZONE_A,2024-01-01 10:00,1.0,5.0",
+        "4,ZONE_C,ZONE_A,2024-01-01 11:00,"
+    });
+
+    TripAnalyzer ta;
+    ta.enableRoutes();
+    ta.ingestFile(path);
+    REQUIRE(ta.countOf("ZONE_A") == 2);
+    REQUIRE(ta.countOf("ZONE_C", 11) == 1);
+    REQUIRE(ta.topRoutes(10).size() == 3);
+    REQUIRE(ta.topRoutes(1)[0].count == 2);
+
+    // routes are off by default
+    TripAnalyzer noRoutes;
+    noRoutes.ingestFile(path);
+    REQUIRE(noRoutes.topRoutes(10).empty());
+    REQUIRE(noRoutes.topZones(10).size() == 3);
+    REQUIRE(noRoutes.countOf("ZONE_A", 9) == 2);
+
+    noRoutes.enableRoutes(true);
+    noRoutes.ingestRow("5,ZONE_A,ZONE_C,2024-01-01 12:00,1.0,1.0");
+    REQUIRE(noRoutes.topRoutes(10).size() == 1);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D19", "[D19]") {
+    const std::string path = "d19.csv";
+    writeFile(path, {
+        HDR,
+        "1,Z,ZX,2024-01-01 09:15,1,1",
+        "2,Z,ZX,2024-01-01T09:20,1,1",
+        "3,Z,ZX,2024-01-01 09:25:59,1,1",
+        "4,Z,ZX,2024-02-29 10:00,1,1",
+        // rejected: not a full timestamp, or not a real date/time
+        "5,Z,ZX,xx 12:00,1,1",
+        "6,Z,ZX,2024-01-01 9:00,1,1",
+        "7,Z,ZX,2024-01-01 24:00,1,1",
+        "8,Z,ZX,2024-01-01 09:60,1,1",
+        "9,Z,ZX,2023-02-29 10:00,1,1",
+        "10,Z,ZX,2024-04-31 10:00,1,1",
+        "11,Z,ZX,2024-13-01 10:00,1,1",
+        "12,Z,ZX,2024-01-01_09:00,1,1",
+        "13,Z,ZX,2024-01-01 09:00:61,1,1",
+        "14,Z,ZX,2024-01-01 09:00 ,1,1",
+        "15,Z,ZX,2024/01/01 09:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.enableDayPartitions();
+    ta.ingestFile(path);
+
+    REQUIRE(ta.countOf("Z") == 4);
+    REQUIRE(ta.countOf("Z", 9) == 3);
+    REQUIRE(ta.countOf("Z", 10) == 1);
+    REQUIRE(ta.topZones("2024-02-29", "2024-02-29", 5).size() == 1);
+    REQUIRE(ta.topZones("2024-02-01", "2024-02-30", 5).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D20", "[D20]") {
+    const std::string p1 = "d20a.csv";
+    const std::string p2 = "d20b.csv";
+    const std::string p3 = "d20c.csv";
+
+    // 1704103200 = 2024-01-01 10:00:00 UTC (a Monday)
+    writeFile(p1, {
+        HDR,
+        "1,Z,ZX,42,1,1",                    // too short to pick epoch mode
+        "2,Z,ZX,1704103200,1,1",
+        "3,Z,ZX,1704106799.5,1,1",
+        "4,Z,ZX,2024-01-01 10:00,1,1"       // epoch mode now: rejected
+    });
+    writeFile(p2, {
+        HDR,
+        "1,Z,ZX,2024-01-01T10:00:00Z,1,1",
+        "2,Z,ZX,2024-01-01T12:30:00.250+02:00,1,1",
+        "3,Z,ZX,2024-01-01T23:30-0100,1,1",
+        "4,Z,ZX,2024-01-01 10:15,1,1",
+        "5,Z,ZX,2024-01-01T10:00:00+2:00,1,1"
+    });
+    writeFile(p3, {
+        HDR,
+        "1,Z,ZX,2024-01-01 10:00,1,1",
+        "2,Z,ZX,1704103200,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.enableDayPartitions();
+    ta.ingestFile(p1);
+    REQUIRE(ta.countOf("Z") == 2);
+    REQUIRE(ta.countOf("Z", 10) == 2);
+    REQUIRE(ta.weekdayHeatmap("Z")[1][10] == 2);
+
+    ta.ingestFile(p2);
+    REQUIRE(ta.countOf("Z") == 4);
+    REQUIRE(ta.countOf("Z", 10) == 3);
+    REQUIRE(ta.weekdayHeatmap("Z")[2][0] == 1);   // 23:30-01:00 is Tuesday 00:30 UTC
+
+    ta.ingestFile(p3);
+    REQUIRE(ta.countOf("Z") == 1);
+
+    // explicit epoch mode with a fixed offset (UTC-5)
+    ta.setTimeFormat(TimeFormat::EpochSeconds, -300);
+    ta.ingestFile(p1);
+    REQUIRE(ta.countOf("Z") == 3);
+    REQUIRE(ta.countOf("Z", 5) == 2);
+    REQUIRE(ta.countOf("Z", 19) == 1);
+    REQUIRE(ta.weekdayHeatmap("Z")[3][19] == 1);  // 42 s is Wednesday 1969-12-31 19:00 local
+    ta.ingestRow("5,Z,ZX,0,1,1");
+    REQUIRE(ta.countOf("Z", 19) == 2);
+
+    ta.setTimeFormat(TimeFormat::Iso8601, 60);
+    ta.ingestFile(p2);
+    REQUIRE(ta.countOf("Z", 11) == 2);
+    REQUIRE(ta.countOf("Z", 10) == 1);            // no designator: already local
+    REQUIRE(ta.countOf("Z", 1) == 1);
+
+    std::remove(p1.c_str());
+    std::remove(p2.c_str());
+    std::remove(p3.c_str());
+}
+
+TEST_CASE("D21", "[D21]") {
+    const std::string path = "d21.csv";
+    {
+        // runs of one pickup zone, each row bringing a new dropoff zone
+        std::ofstream out(path);
+        out << HDR << "\n";
+        int id = 0;
+        for (int run = 0; run < 30; ++run)
+            for (int i = 0; i < 200; ++i, ++id)
+                out << id << ",ZONE_" << run % 3 << ",D" << id << ",2024-01-01 0" << i % 10 << ":00,1,1\n";
+        out << id << ",ZONE_1x,D0,2024-01-01 01:00,1,1\n";
+        out << id + 1 << ",ZONE_,D0,2024-01-01 01:00,1,1\n";
+    }
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    REQUIRE(ta.countOf("ZONE_0") == 2000);
+    REQUIRE(ta.countOf("ZONE_2", 9) == 200);
+    REQUIRE(ta.countOf("ZONE_1x") == 1);
+    REQUIRE(ta.countOf("ZONE_") == 1);
+    REQUIRE(ta.zoneRankingSize() == 5);
+
+    // the cached zone must not survive a reset
+    ta.reset();
+    ta.ingestRow("1,ZONE_9,D0,2024-01-01 01:00,1,1");
+    ta.ingestRow("2,ZONE_0,D0,2024-01-01 01:00,1,1");
+    REQUIRE(ta.countOf("ZONE_0") == 1);
+    REQUIRE(ta.countOf("ZONE_9") == 1);
+    REQUIRE(ta.zoneName(0) == "ZONE_9");
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D22", "[D22]") {
+    const std::string path = "d22.csv";
+    {
+        std::ofstream out(path);
+        out << HDR << "\n";
+        int id = 0;
+        // enough distinct ZONEnnn names to switch to the direct index
+        for (int r = 0; r < 3; ++r)
+            for (int z = 0; z < 100; ++z, ++id)
+                out << id << ",ZONE" << (z < 10 ? "00" : "0") << z << ",ZONE" << z << ",2024-01-01 10:00,1,1\n";
+        // same digits, different width: distinct zones
+        out << id++ << ",ZONE7,ZONE07,2024-01-01 11:00,1,1\n";
+        out << id++ << ",ZONE0007,ZONE007,2024-01-01 11:00,1,1\n";
+        // doesn't fit the pattern: falls back to hashing from here on
+        out << id++ << ",ZONE_X,ZONE007,2024-01-01 12:00,1,1\n";
+        out << id++ << ",ZONE007,ZONE_X,2024-01-01 12:00,1,1\n";
+        out << id++ << ",ZONE1234567,ZONE_X,2024-01-01 12:00,1,1\n";
+    }
+
+    TripAnalyzer ta;
+    ta.enableRoutes();
+    ta.ingestFile(path);
+    REQUIRE(ta.countOf("ZONE007") == 4);
+    REQUIRE(ta.countOf("ZONE007", 12) == 1);
+    REQUIRE(ta.countOf("ZONE099") == 3);
+    REQUIRE(ta.countOf("ZONE7") == 1);
+    REQUIRE(ta.countOf("ZONE0007") == 1);
+    REQUIRE(ta.countOf("ZONE_X") == 1);
+    REQUIRE(ta.countOf("ZONE1234567") == 1);
+    REQUIRE(ta.zoneRankingSize() == 104);
+    REQUIRE(ta.topRoutes(1)[0].count == 3);
+
+    // a fresh ingest learns again
+    ta.ingestFile(path);
+    REQUIRE(ta.countOf("ZONE007") == 4);
+    REQUIRE(ta.zoneRankingSize() == 104);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D23", "[D23]") {
+    const std::string path = "d23.csv";
+    const int zones = 5000;
+    {
+        // many non-numeric names, rows spread over several read buffers,
+        // with bad rows in between
+        std::ofstream out(path);
+        out << HDR << "\n";
+        for (int i = 0; i < 60000; ++i) {
+            int z = (i * 7919) % zones;
+            out << i << ",Z" << char('A' + z % 26) << "_" << z << ",D_" << z % 50;
+            out << (i % 97 == 0 ? ",bad" : ",2024-01-02 10:00") << ",1,1\n";
+        }
+    }
+
+    TripAnalyzer ta;
+    ta.enableRoutes();
+    ta.ingestFile(path);
+    REQUIRE(ta.zoneRankingSize() == (size_t)zones);
+    REQUIRE(ta.zoneName(0) == "ZH_2919");     // row 0 is bad; ids follow first use
+    REQUIRE(ta.zoneName(1) == "D_19");
+
+    long long total = 0;
+    for (const auto& z : ta.topZones(zones)) total += z.count;
+    REQUIRE(total == 60000 - (60000 + 96) / 97);
+    REQUIRE(ta.countOf("ZH_7", 10) == 12);
+    REQUIRE(ta.countOf("D_7") == 0);
+    REQUIRE(ta.countOf("ZH_") == 0);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D24", "[D24]") {
+    const std::string path = "d24.csv";
+    const int rows = 20000;                   // spans several column blocks
+    {
+        std::ofstream out(path);
+        out << HDR << "\n";
+        for (int i = 0; i < rows; ++i) {
+            out << i << ",Z" << i % 37 << ",Z" << i % 5 << ",2024-01-0" << 1 + i % 7 << " "
+                << (i % 24 < 10 ? "0" : "") << i % 24 << ":00,"
+                << (i % 100 == 0 ? "x" : "2.0") << "," << (i % 50 == 0 ? "" : "3.0") << "\n";
+        }
+    }
+
+    TripAnalyzer ta;
+    ta.enableTripMetrics();
+    ta.enableLiveRanking();
+    ta.enableDayPartitions();
+    ta.enableRoutes();
+    ta.ingestFile(path);
+
+    MetricErrors err = ta.metricErrors();
+    REQUIRE(err.badDistance == rows / 100);
+    REQUIRE(err.badFare == rows / 50);
+
+    long long trips = 0;
+    for (const auto& z : ta.topZones(100)) trips += z.count;
+    REQUIRE(trips == rows);
+    REQUIRE(ta.countOf("Z0") == 541);
+    double revenue = 0;
+    for (const auto& z : ta.topRevenueZones(100)) revenue += z.value;
+    REQUIRE(revenue == Catch::Approx((rows - rows / 50) * 3.0));
+
+    long long routeTrips = 0;
+    for (const auto& r : ta.topRoutes(1000)) routeTrips += r.count;
+    REQUIRE(routeTrips == rows);
+
+    long long heat = 0;
+    for (const auto& day : ta.weekdayHeatmap("Z1"))
+        for (long long v : day) heat += v;
+    REQUIRE(heat == ta.countOf("Z1"));
+
+    // rows added one at a time are visible right away
+    const long long before = ta.countOf("Z36", 5);
+    ta.ingestRow("x,Z36,Z0,2024-01-01 05:00,1.0,1.0");
+    REQUIRE(ta.countOf("Z36", 5) == before + 1);
+    REQUIRE(ta.countOf("Z36") == 541);
+    REQUIRE(ta.rankOf("Z36") <= 21);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D25", "[D25]") {
+    const std::string path = "d25.csv";
+    {
+        // enough zones for the slot table to outgrow a 2 MiB page
+        std::ofstream out(path);
+        out << HDR << "\n";
+        for (int i = 0; i < 120000; ++i)
+            out << i << ",Q" << (i * 7) % 100003 << ",Q" << i % 11 << ",2024-02-0" << 1 + i % 9 << " "
+                << (i % 24 < 10 ? "0" : "") << i % 24 << ":30,1,1\n";
+    }
+
+    TripAnalyzer plain;
+    plain.enableRoutes();
+    plain.ingestFile(path);
+    const auto zones = plain.topZones(50);
+    const auto slots = plain.topBusySlots(50);
+    const auto routes = plain.topRoutes(20);
+    const size_t zoneCount = plain.zoneRankingSize();
+
+    TripAnalyzer huge;
+    huge.enableHugePages();
+    huge.enableRoutes();
+    huge.ingestFile(path);
+    REQUIRE(huge.zoneRankingSize() == zoneCount);
+    const auto hugeZones = huge.topZones(50);
+    const auto hugeSlots = huge.topBusySlots(50);
+    REQUIRE(hugeZones.size() == zones.size());
+    REQUIRE(hugeSlots.size() == slots.size());
+    for (size_t i = 0; i < zones.size(); ++i) {
+        REQUIRE(hugeZones[i].zone == zones[i].zone);
+        REQUIRE(hugeZones[i].count == zones[i].count);
+    }
+    for (size_t i = 0; i < slots.size(); ++i) {
+        REQUIRE(hugeSlots[i].zone == slots[i].zone);
+        REQUIRE(hugeSlots[i].hour == slots[i].hour);
+    }
+    REQUIRE(huge.topRoutes(20).size() == routes.size());
+    REQUIRE(huge.topRoutes(20)[0].count == routes[0].count);
+
+    // switching back mid-way keeps working on the existing tables
+    huge.enableHugePages(false);
+    huge.ingestRow("x,Q7,Q0,2024-02-01 10:00,1,1");
+    REQUIRE(huge.countOf("Q7") == 3);
+
+    std::remove(path.c_str());
+}